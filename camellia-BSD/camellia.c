@@ -37,6 +37,7 @@
 #include <assert.h>
 
 #include "camellia.h"
+#include "cpudispatch.h"
 
 /* key constants */
 
@@ -1393,6 +1394,131 @@ static void camellia_decrypt256(const uint32_t *subkey, uint32_t *io)
     return;
 }
 
+/**
+ * interleaved versions for several independent blocks (kjw)
+ *
+ * N blocks walk through the rounds side by side, so the table lookups
+ * of one block hide the latency of the others.  Only worth it where
+ * there is no chaining between the blocks, e.g. CBC decryption.
+ */
+
+#ifdef __GNUC__
+# define CAMELLIA_LANES(n, N) _Pragma("GCC unroll 16") for(n=0; n<(N); n++)
+# define CAMELLIA_INLINE inline __attribute__((always_inline))
+#else
+# define CAMELLIA_LANES(n, N) for(n=0; n<(N); n++)
+# define CAMELLIA_INLINE inline
+#endif
+
+static CAMELLIA_INLINE void camellia_256_lanes(const uint32_t *subkey, uint32_t (*io)[4], const int N, const int dec)
+{
+    uint32_t il[CAMELLIA_LANES_MAX], ir[CAMELLIA_LANES_MAX],
+             t0[CAMELLIA_LANES_MAX], t1[CAMELLIA_LANES_MAX];
+    int n, r, k, kx;
+    const int w0 = dec ? 32 : 0;
+    const int w1 = dec ? 0 : 32;
+
+    /* pre whitening but absorb kw2*/
+    CAMELLIA_LANES(n, N)
+    {
+	io[n][0] ^= CamelliaSubkeyL(w0);
+	io[n][1] ^= CamelliaSubkeyR(w0);
+    }
+
+    /* main iteration, 4 times 6 rounds with FL/FL^-1 in between */
+    for(r=0; r<4; r++)
+    {
+	if(r>0)
+	{
+	    kx = dec ? 33-8*r : 8*r;
+	    CAMELLIA_LANES(n, N)
+		CAMELLIA_FLS(io[n][0],io[n][1],io[n][2],io[n][3],
+			     CamelliaSubkeyL(kx),CamelliaSubkeyR(kx),
+			     CamelliaSubkeyL(dec ? kx-1 : kx+1),CamelliaSubkeyR(dec ? kx-1 : kx+1),
+			     t0[n],t1[n],il[n],ir[n]);
+	}
+	for(k=0; k<6; k+=2)
+	{
+	    kx = dec ? 31-8*r-k : 2+8*r+k;
+	    CAMELLIA_LANES(n, N)
+		CAMELLIA_ROUNDSM(io[n][0],io[n][1],
+				 CamelliaSubkeyL(kx),CamelliaSubkeyR(kx),
+				 io[n][2],io[n][3],il[n],ir[n],t0[n],t1[n]);
+	    kx = dec ? kx-1 : kx+1;
+	    CAMELLIA_LANES(n, N)
+		CAMELLIA_ROUNDSM(io[n][2],io[n][3],
+				 CamelliaSubkeyL(kx),CamelliaSubkeyR(kx),
+				 io[n][0],io[n][1],il[n],ir[n],t0[n],t1[n]);
+	}
+    }
+
+    /* post whitening but kw4 */
+    CAMELLIA_LANES(n, N)
+    {
+	io[n][2] ^= CamelliaSubkeyL(w1);
+	io[n][3] ^= CamelliaSubkeyR(w1);
+
+	t0[n] = io[n][0];
+	t1[n] = io[n][1];
+	io[n][0] = io[n][2];
+	io[n][1] = io[n][3];
+	io[n][2] = t0[n];
+	io[n][3] = t1[n];
+    }
+}
+
+static CAMELLIA_INLINE void camellia_256_blocks(const uint32_t *subkey, const unsigned char *in, unsigned char *out, const int N, const int dec)
+{
+    uint32_t io[CAMELLIA_LANES_MAX][4];
+    int n;
+
+    CAMELLIA_LANES(n, N)
+    {
+	io[n][0] = GETU32(in + n*CAMELLIA_BLOCK_SIZE);
+	io[n][1] = GETU32(in + n*CAMELLIA_BLOCK_SIZE + 4);
+	io[n][2] = GETU32(in + n*CAMELLIA_BLOCK_SIZE + 8);
+	io[n][3] = GETU32(in + n*CAMELLIA_BLOCK_SIZE + 12);
+    }
+    camellia_256_lanes(subkey, io, N, dec);
+    CAMELLIA_LANES(n, N)
+    {
+	PUTU32(out + n*CAMELLIA_BLOCK_SIZE, io[n][0]);
+	PUTU32(out + n*CAMELLIA_BLOCK_SIZE + 4, io[n][1]);
+	PUTU32(out + n*CAMELLIA_BLOCK_SIZE + 8, io[n][2]);
+	PUTU32(out + n*CAMELLIA_BLOCK_SIZE + 12, io[n][3]);
+    }
+}
+
+static void camellia_encrypt256_x16(const uint32_t *subkey, const unsigned char *in, unsigned char *out)
+{
+    camellia_256_blocks(subkey, in, out, 16, 0);
+}
+
+static void camellia_encrypt256_x8(const uint32_t *subkey, const unsigned char *in, unsigned char *out)
+{
+    camellia_256_blocks(subkey, in, out, 8, 0);
+}
+
+static void camellia_encrypt256_x4(const uint32_t *subkey, const unsigned char *in, unsigned char *out)
+{
+    camellia_256_blocks(subkey, in, out, 4, 0);
+}
+
+static void camellia_decrypt256_x16(const uint32_t *subkey, const unsigned char *in, unsigned char *out)
+{
+    camellia_256_blocks(subkey, in, out, 16, 1);
+}
+
+static void camellia_decrypt256_x8(const uint32_t *subkey, const unsigned char *in, unsigned char *out)
+{
+    camellia_256_blocks(subkey, in, out, 8, 1);
+}
+
+static void camellia_decrypt256_x4(const uint32_t *subkey, const unsigned char *in, unsigned char *out)
+{
+    camellia_256_blocks(subkey, in, out, 4, 1);
+}
+
 /***
  *
  * API for compatibility
@@ -1483,3 +1609,83 @@ void Camellia_DecryptBlock(int keyBitLength,
     PUTU32(plaintext + 8, tmp[2]);
     PUTU32(plaintext + 12, tmp[3]);
 }
+
+/* ECB over a run of blocks, the interleaved kernels take as many as they can (kjw) */
+
+void Camellia_EncryptBlocks(int keyBitLength,
+			    const unsigned char *plaintext,
+			    const KeyTableType *keyTable,
+			    unsigned char *ciphertext,
+			    unsigned blocks)
+{
+    if(keyBitLength==128)
+    {
+	for(; blocks>0; blocks--, plaintext+=CAMELLIA_BLOCK_SIZE, ciphertext+=CAMELLIA_BLOCK_SIZE)
+	    Camellia_EncryptBlock(keyBitLength, plaintext, keyTable, ciphertext);
+	return;
+    }
+
+    /* widest kernel first, see cpudispatch.c */
+    if(cpu_isa>=ISA_AVX512 && cpu_has_gfni)
+	for(; blocks>=64; blocks-=64, plaintext+=64*CAMELLIA_BLOCK_SIZE, ciphertext+=64*CAMELLIA_BLOCK_SIZE)
+	    camellia_256_x64_gfni(keyTable, plaintext, ciphertext, 0);
+    if(cpu_isa>=ISA_AVX2 && cpu_has_aes)
+	for(; blocks>=32; blocks-=32, plaintext+=32*CAMELLIA_BLOCK_SIZE, ciphertext+=32*CAMELLIA_BLOCK_SIZE)
+	    camellia_256_x32_avx2(keyTable, plaintext, ciphertext, 0);
+    if(cpu_isa>=ISA_SSE4 && cpu_has_aes)
+	for(; blocks>=16; blocks-=16, plaintext+=16*CAMELLIA_BLOCK_SIZE, ciphertext+=16*CAMELLIA_BLOCK_SIZE)
+	    camellia_256_x16_aesni(keyTable, plaintext, ciphertext, 0);
+    for(; blocks>=16; blocks-=16, plaintext+=16*CAMELLIA_BLOCK_SIZE, ciphertext+=16*CAMELLIA_BLOCK_SIZE)
+	camellia_encrypt256_x16(keyTable, plaintext, ciphertext);
+    if(blocks>=8)
+    {
+	camellia_encrypt256_x8(keyTable, plaintext, ciphertext);
+	blocks-=8, plaintext+=8*CAMELLIA_BLOCK_SIZE, ciphertext+=8*CAMELLIA_BLOCK_SIZE;
+    }
+    if(blocks>=4)
+    {
+	camellia_encrypt256_x4(keyTable, plaintext, ciphertext);
+	blocks-=4, plaintext+=4*CAMELLIA_BLOCK_SIZE, ciphertext+=4*CAMELLIA_BLOCK_SIZE;
+    }
+    for(; blocks>0; blocks--, plaintext+=CAMELLIA_BLOCK_SIZE, ciphertext+=CAMELLIA_BLOCK_SIZE)
+	Camellia_EncryptBlock(keyBitLength, plaintext, keyTable, ciphertext);
+}
+
+void Camellia_DecryptBlocks(int keyBitLength,
+			    const unsigned char *ciphertext,
+			    const KeyTableType *keyTable,
+			    unsigned char *plaintext,
+			    unsigned blocks)
+{
+    if(keyBitLength==128)
+    {
+	for(; blocks>0; blocks--, ciphertext+=CAMELLIA_BLOCK_SIZE, plaintext+=CAMELLIA_BLOCK_SIZE)
+	    Camellia_DecryptBlock(keyBitLength, ciphertext, keyTable, plaintext);
+	return;
+    }
+
+    /* widest kernel first, see cpudispatch.c */
+    if(cpu_isa>=ISA_AVX512 && cpu_has_gfni)
+	for(; blocks>=64; blocks-=64, ciphertext+=64*CAMELLIA_BLOCK_SIZE, plaintext+=64*CAMELLIA_BLOCK_SIZE)
+	    camellia_256_x64_gfni(keyTable, ciphertext, plaintext, 1);
+    if(cpu_isa>=ISA_AVX2 && cpu_has_aes)
+	for(; blocks>=32; blocks-=32, ciphertext+=32*CAMELLIA_BLOCK_SIZE, plaintext+=32*CAMELLIA_BLOCK_SIZE)
+	    camellia_256_x32_avx2(keyTable, ciphertext, plaintext, 1);
+    if(cpu_isa>=ISA_SSE4 && cpu_has_aes)
+	for(; blocks>=16; blocks-=16, ciphertext+=16*CAMELLIA_BLOCK_SIZE, plaintext+=16*CAMELLIA_BLOCK_SIZE)
+	    camellia_256_x16_aesni(keyTable, ciphertext, plaintext, 1);
+    for(; blocks>=16; blocks-=16, ciphertext+=16*CAMELLIA_BLOCK_SIZE, plaintext+=16*CAMELLIA_BLOCK_SIZE)
+	camellia_decrypt256_x16(keyTable, ciphertext, plaintext);
+    if(blocks>=8)
+    {
+	camellia_decrypt256_x8(keyTable, ciphertext, plaintext);
+	blocks-=8, ciphertext+=8*CAMELLIA_BLOCK_SIZE, plaintext+=8*CAMELLIA_BLOCK_SIZE;
+    }
+    if(blocks>=4)
+    {
+	camellia_decrypt256_x4(keyTable, ciphertext, plaintext);
+	blocks-=4, ciphertext+=4*CAMELLIA_BLOCK_SIZE, plaintext+=4*CAMELLIA_BLOCK_SIZE;
+    }
+    for(; blocks>0; blocks--, ciphertext+=CAMELLIA_BLOCK_SIZE, plaintext+=CAMELLIA_BLOCK_SIZE)
+	Camellia_DecryptBlock(keyBitLength, ciphertext, keyTable, plaintext);
+}
@@ -35,6 +35,7 @@
 #define CAMELLIA_BLOCK_SIZE 16
 #define CAMELLIA_TABLE_BYTE_LEN 272
 #define CAMELLIA_TABLE_WORD_LEN (CAMELLIA_TABLE_BYTE_LEN / 4)
+#define CAMELLIA_LANES_MAX 64
 
 //typedef uint32_t KEY_TABLE_TYPE[CAMELLIA_TABLE_WORD_LEN];
 typedef uint32_t KeyTableType;
@@ -54,6 +55,39 @@ void Camellia_DecryptBlock(int keyBitLength,
 			   const KeyTableType *keyTable,
 			   uint8_t *plaintext);
 
+void Camellia_EncryptBlocks(int keyBitLength,
+			    const uint8_t *plaintext,
+			    const KeyTableType *keyTable,
+			    uint8_t *cipherText,
+			    unsigned blocks);
+
+void Camellia_DecryptBlocks(int keyBitLength,
+			    const uint8_t *cipherText,
+			    const KeyTableType *keyTable,
+			    uint8_t *plaintext,
+			    unsigned blocks);
+
+
+
+/* vectorized backends (kjw), only to be called when cpudispatch.c says so */
+
+/* camellia_aesni.c, AES-NI + SSSE3 */
+void camellia_256_x16_aesni(const KeyTableType *keyTable,
+			    const unsigned char *in,
+			    unsigned char *out,
+			    int dec);
+
+/* camellia_aesni.c with -DCAMELLIA_X32, AES-NI + AVX2 */
+void camellia_256_x32_avx2(const KeyTableType *keyTable,
+			   const unsigned char *in,
+			   unsigned char *out,
+			   int dec);
+
+/* camellia_gfni.c, GFNI + AVX512BW */
+void camellia_256_x64_gfni(const KeyTableType *keyTable,
+			   const unsigned char *in,
+			   unsigned char *out,
+			   int dec);
 
 
 /* this is the old implementation API (kjw) */
@@ -64,6 +98,8 @@ void Camellia_DecryptBlock(int keyBitLength,
 #define camellia_ekeygen(rawk, keyt) Camellia_Ekeygen(256, rawk, keyt)
 #define camellia_encrypt(p,k,c) Camellia_EncryptBlock(256, p, k, c)
 #define camellia_decrypt(c,k,p) Camellia_DecryptBlock(256, c, k, p)
+#define camellia_encrypt_n(p,k,c,n) Camellia_EncryptBlocks(256, p, k, c, n)
+#define camellia_decrypt_n(c,k,p,n) Camellia_DecryptBlocks(256, c, k, p, n)
 
 
 //#ifdef  __cplusplus
@@ -0,0 +1,313 @@
+/* camellia_aesni.c - vectorized Camellia-256 for x86 (kjw)
+ *
+ * Camellia and AES use the same inversion in GF(2^8), only the affine
+ * transformations around it differ.  So every Camellia S-box is computed as
+ *
+ *     s(x) = post( AES_SubBytes( pre(x) ) )
+ *
+ * where pre and post are affine maps done with two nibble table lookups
+ * (pshufb) each, and AES_SubBytes is aesenclast with a zero round key
+ * after undoing its ShiftRows.  With the 16 blocks byte-sliced by
+ * camellia_bslice.h this gives 16 blocks per __m128i and 32 blocks per __m256i.
+ *
+ * Results are bit-identical to Camellia_EncryptBlock() / Camellia_DecryptBlock().
+ *
+ * The file is compiled twice: as is with -msse4.1 -maes for the 16 block
+ * kernel, and with -DCAMELLIA_X32 -mavx2 -maes for the 32 block one.
+ * Without those flags a kernel becomes a stub, cpudispatch.c never lets
+ * it be called then.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "camellia.h"
+
+#if !defined(CAMELLIA_X32) && defined(__AES__) && defined(__SSSE3__)
+#define CBS_BUILD_X16 1
+#elif defined(CAMELLIA_X32) && defined(__AES__) && defined(__AVX2__)
+#define CBS_BUILD_X32 1
+#endif
+
+#if CBS_BUILD_X16 || CBS_BUILD_X32
+
+#include <immintrin.h>
+
+
+#define CamelliaSubkeyL(INDEX) (subkey[(INDEX)*2])
+#define CamelliaSubkeyR(INDEX) (subkey[(INDEX)*2 + 1])
+
+
+/* nibble tables of the affine maps, low nibble table first */
+
+#define CBS_TAB(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p) \
+    { a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p, a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p }
+
+static const uint8_t cbs_pre_s1[2][32] __attribute__((aligned(32))) = {
+    CBS_TAB(0x45,0xe8,0x40,0xed,0x2e,0x83,0x2b,0x86,0x4b,0xe6,0x4e,0xe3,0x20,0x8d,0x25,0x88),
+    CBS_TAB(0x00,0x51,0xf1,0xa0,0x8a,0xdb,0x7b,0x2a,0x09,0x58,0xf8,0xa9,0x83,0xd2,0x72,0x23) };
+static const uint8_t cbs_pre_s4[2][32] __attribute__((aligned(32))) = {
+    CBS_TAB(0x45,0x40,0x2e,0x2b,0x4b,0x4e,0x20,0x25,0x14,0x11,0x7f,0x7a,0x1a,0x1f,0x71,0x74),
+    CBS_TAB(0x00,0xf1,0x8a,0x7b,0x09,0xf8,0x83,0x72,0xad,0x5c,0x27,0xd6,0xa4,0x55,0x2e,0xdf) };
+static const uint8_t cbs_post_s1[2][32] __attribute__((aligned(32))) = {
+    CBS_TAB(0x3c,0xcc,0xcf,0x3f,0x32,0xc2,0xc1,0x31,0xdc,0x2c,0x2f,0xdf,0xd2,0x22,0x21,0xd1),
+    CBS_TAB(0x00,0xf9,0x86,0x7f,0xd7,0x2e,0x51,0xa8,0xa4,0x5d,0x22,0xdb,0x73,0x8a,0xf5,0x0c) };
+static const uint8_t cbs_post_s2[2][32] __attribute__((aligned(32))) = {
+    CBS_TAB(0x78,0x99,0x9f,0x7e,0x64,0x85,0x83,0x62,0xb9,0x58,0x5e,0xbf,0xa5,0x44,0x42,0xa3),
+    CBS_TAB(0x00,0xf3,0x0d,0xfe,0xaf,0x5c,0xa2,0x51,0x49,0xba,0x44,0xb7,0xe6,0x15,0xeb,0x18) };
+static const uint8_t cbs_post_s3[2][32] __attribute__((aligned(32))) = {
+    CBS_TAB(0x1e,0x66,0xe7,0x9f,0x19,0x61,0xe0,0x98,0x6e,0x16,0x97,0xef,0x69,0x11,0x90,0xe8),
+    CBS_TAB(0x00,0xfc,0x43,0xbf,0xeb,0x17,0xa8,0x54,0x52,0xae,0x11,0xed,0xb9,0x45,0xfa,0x06) };
+
+/* inverse ShiftRows, so aesenclast is a plain SubBytes */
+static const uint8_t cbs_invsr[32] __attribute__((aligned(32))) =
+    CBS_TAB(0x00,0x0d,0x0a,0x07,0x04,0x01,0x0e,0x0b,0x08,0x05,0x02,0x0f,0x0c,0x09,0x06,0x03);
+
+static const uint8_t cbs_low4[32] __attribute__((aligned(32))) =
+    CBS_TAB(0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f,0x0f);
+
+#undef CBS_TAB
+
+#endif
+
+
+/* ************************************************************************ */
+/* 16 blocks in __m128i, AES-NI + SSSE3                                     */
+/* ************************************************************************ */
+
+
+#if CBS_BUILD_X16
+
+
+#define CBS_L128(t) _mm_load_si128((const __m128i *)(t))
+
+static inline __m128i cbs128_filter(__m128i x, const uint8_t (*t)[32])
+{
+    const __m128i m = CBS_L128(cbs_low4);
+
+    return _mm_xor_si128(_mm_shuffle_epi8(CBS_L128(t[0]), _mm_and_si128(x, m)),
+                         _mm_shuffle_epi8(CBS_L128(t[1]), _mm_and_si128(_mm_srli_epi16(x, 4), m)));
+}
+
+static inline __m128i cbs128_sbox(__m128i x, const uint8_t (*pre)[32], const uint8_t (*post)[32])
+{
+    x = _mm_shuffle_epi8(cbs128_filter(x, pre), CBS_L128(cbs_invsr));
+    x = _mm_aesenclast_si128(x, _mm_setzero_si128());
+    return cbs128_filter(x, post);
+}
+
+static inline void cbs128_transpose(__m128i *a)
+{
+    __m128i b[16];
+    int s, k;
+
+    /* four perfect shuffles are a 16x16 byte transpose */
+    for(s=0; s<4; s++)
+    {
+        for(k=0; k<8; k++)
+        {
+            b[2*k]   = _mm_unpacklo_epi8(a[k], a[k+8]);
+            b[2*k+1] = _mm_unpackhi_epi8(a[k], a[k+8]);
+        }
+        for(k=0; k<16; k++)
+            a[k] = b[k];
+    }
+}
+
+static inline void cbs128_loadt(__m128i *x, const unsigned char *in)
+{
+    int j;
+
+    for(j=0; j<16; j++)
+        x[j] = _mm_loadu_si128((const __m128i *)(in + j*CAMELLIA_BLOCK_SIZE));
+    cbs128_transpose(x);
+}
+
+static inline void cbs128_storet(__m128i *x, unsigned char *out)
+{
+    int j;
+
+    cbs128_transpose(x);
+    for(j=0; j<16; j++)
+        _mm_storeu_si128((__m128i *)(out + j*CAMELLIA_BLOCK_SIZE), x[j]);
+}
+
+#define CBS_VEC             __m128i
+#define CBS_BLOCKS          16
+#define CBS_FUNC            camellia_256_bslice128
+#define CBS_FUNC_ROUND      camellia_256_bslice128_round
+#define CBS_FUNC_RL1        camellia_256_bslice128_rl1
+#define CBS_FUNC_FLS        camellia_256_bslice128_fls
+#define CBS_XOR(a,b)        _mm_xor_si128(a, b)
+#define CBS_AND(a,b)        _mm_and_si128(a, b)
+#define CBS_OR(a,b)         _mm_or_si128(a, b)
+#define CBS_SET1(c)         _mm_set1_epi8((char)(c))
+#define CBS_SHL1(a)         _mm_add_epi8(a, a)
+#define CBS_MSB(a)          _mm_and_si128(_mm_srli_epi16(a, 7), _mm_set1_epi8(1))
+#define CBS_S1(a)           cbs128_sbox(a, cbs_pre_s1, cbs_post_s1)
+#define CBS_S2(a)           cbs128_sbox(a, cbs_pre_s1, cbs_post_s2)
+#define CBS_S3(a)           cbs128_sbox(a, cbs_pre_s1, cbs_post_s3)
+#define CBS_S4(a)           cbs128_sbox(a, cbs_pre_s4, cbs_post_s1)
+#define CBS_LOADT(x, in)    cbs128_loadt(x, in)
+#define CBS_STORET(x, out)  cbs128_storet(x, out)
+
+#include "camellia_bslice.h"
+
+#undef CBS_VEC
+#undef CBS_BLOCKS
+#undef CBS_FUNC
+#undef CBS_FUNC_ROUND
+#undef CBS_FUNC_RL1
+#undef CBS_FUNC_FLS
+#undef CBS_XOR
+#undef CBS_AND
+#undef CBS_OR
+#undef CBS_SET1
+#undef CBS_SHL1
+#undef CBS_MSB
+#undef CBS_S1
+#undef CBS_S2
+#undef CBS_S3
+#undef CBS_S4
+#undef CBS_LOADT
+#undef CBS_STORET
+
+
+void camellia_256_x16_aesni(const KeyTableType *keyTable, const unsigned char *in, unsigned char *out, int dec)
+{
+    camellia_256_bslice128(keyTable, in, out, dec);
+}
+
+#elif !defined(CAMELLIA_X32)
+
+void camellia_256_x16_aesni(const KeyTableType *keyTable, const unsigned char *in, unsigned char *out, int dec)
+{
+    abort();
+}
+
+#endif
+
+
+/* ************************************************************************ */
+/* 32 blocks in __m256i, AVX2 (+ VAES when available)                       */
+/* ************************************************************************ */
+
+
+#if CBS_BUILD_X32
+
+#define CBS_L256(t) _mm256_load_si256((const __m256i *)(t))
+
+static inline __m256i cbs256_filter(__m256i x, const uint8_t (*t)[32])
+{
+    const __m256i m = CBS_L256(cbs_low4);
+
+    return _mm256_xor_si256(_mm256_shuffle_epi8(CBS_L256(t[0]), _mm256_and_si256(x, m)),
+                            _mm256_shuffle_epi8(CBS_L256(t[1]), _mm256_and_si256(_mm256_srli_epi16(x, 4), m)));
+}
+
+static inline __m256i cbs256_sbox(__m256i x, const uint8_t (*pre)[32], const uint8_t (*post)[32])
+{
+    x = _mm256_shuffle_epi8(cbs256_filter(x, pre), CBS_L256(cbs_invsr));
+#ifdef __VAES__
+    x = _mm256_aesenclast_epi128(x, _mm256_setzero_si256());
+#else
+    x = _mm256_set_m128i(_mm_aesenclast_si128(_mm256_extracti128_si256(x, 1), _mm_setzero_si128()),
+                         _mm_aesenclast_si128(_mm256_castsi256_si128(x), _mm_setzero_si128()));
+#endif
+    return cbs256_filter(x, post);
+}
+
+static inline void cbs256_transpose(__m256i *a)
+{
+    __m256i b[16];
+    int s, k;
+
+    /* unpack works per 128 bit lane, so this is two 16x16 transposes side by side */
+    for(s=0; s<4; s++)
+    {
+        for(k=0; k<8; k++)
+        {
+            b[2*k]   = _mm256_unpacklo_epi8(a[k], a[k+8]);
+            b[2*k+1] = _mm256_unpackhi_epi8(a[k], a[k+8]);
+        }
+        for(k=0; k<16; k++)
+            a[k] = b[k];
+    }
+}
+
+/* row j carries block j in the low lane and block j+16 in the high lane */
+
+static inline void cbs256_loadt(__m256i *x, const unsigned char *in)
+{
+    int j;
+
+    for(j=0; j<16; j++)
+        x[j] = _mm256_loadu2_m128i((const __m128i *)(in + (j+16)*CAMELLIA_BLOCK_SIZE),
+                                   (const __m128i *)(in + j*CAMELLIA_BLOCK_SIZE));
+    cbs256_transpose(x);
+}
+
+static inline void cbs256_storet(__m256i *x, unsigned char *out)
+{
+    int j;
+
+    cbs256_transpose(x);
+    for(j=0; j<16; j++)
+        _mm256_storeu2_m128i((__m128i *)(out + (j+16)*CAMELLIA_BLOCK_SIZE),
+                             (__m128i *)(out + j*CAMELLIA_BLOCK_SIZE), x[j]);
+}
+
+#define CBS_VEC             __m256i
+#define CBS_BLOCKS          32
+#define CBS_FUNC            camellia_256_bslice256
+#define CBS_FUNC_ROUND      camellia_256_bslice256_round
+#define CBS_FUNC_RL1        camellia_256_bslice256_rl1
+#define CBS_FUNC_FLS        camellia_256_bslice256_fls
+#define CBS_XOR(a,b)        _mm256_xor_si256(a, b)
+#define CBS_AND(a,b)        _mm256_and_si256(a, b)
+#define CBS_OR(a,b)         _mm256_or_si256(a, b)
+#define CBS_SET1(c)         _mm256_set1_epi8((char)(c))
+#define CBS_SHL1(a)         _mm256_add_epi8(a, a)
+#define CBS_MSB(a)          _mm256_and_si256(_mm256_srli_epi16(a, 7), _mm256_set1_epi8(1))
+#define CBS_S1(a)           cbs256_sbox(a, cbs_pre_s1, cbs_post_s1)
+#define CBS_S2(a)           cbs256_sbox(a, cbs_pre_s1, cbs_post_s2)
+#define CBS_S3(a)           cbs256_sbox(a, cbs_pre_s1, cbs_post_s3)
+#define CBS_S4(a)           cbs256_sbox(a, cbs_pre_s4, cbs_post_s1)
+#define CBS_LOADT(x, in)    cbs256_loadt(x, in)
+#define CBS_STORET(x, out)  cbs256_storet(x, out)
+
+#include "camellia_bslice.h"
+
+#undef CBS_VEC
+#undef CBS_BLOCKS
+#undef CBS_FUNC
+#undef CBS_FUNC_ROUND
+#undef CBS_FUNC_RL1
+#undef CBS_FUNC_FLS
+#undef CBS_XOR
+#undef CBS_AND
+#undef CBS_OR
+#undef CBS_SET1
+#undef CBS_SHL1
+#undef CBS_MSB
+#undef CBS_S1
+#undef CBS_S2
+#undef CBS_S3
+#undef CBS_S4
+#undef CBS_LOADT
+#undef CBS_STORET
+
+
+void camellia_256_x32_avx2(const KeyTableType *keyTable, const unsigned char *in, unsigned char *out, int dec)
+{
+    camellia_256_bslice256(keyTable, in, out, dec);
+}
+
+#elif defined(CAMELLIA_X32)
+
+void camellia_256_x32_avx2(const KeyTableType *keyTable, const unsigned char *in, unsigned char *out, int dec)
+{
+    abort();
+}
+
+#endif
@@ -0,0 +1,158 @@
+/* camellia_bslice.h - byte-sliced Camellia-256 core (kjw)
+ *
+ * No include guard, this file is a template.  The including file defines
+ *
+ *   CBS_VEC                  vector type
+ *   CBS_BLOCKS               blocks per call (16 per 128 bit of CBS_VEC)
+ *   CBS_FUNC                 name of the generated function
+ *   CBS_FUNC_ROUND/RL1/FLS   names of its static helpers
+ *   CBS_XOR/AND/OR(a,b)      bitwise operations
+ *   CBS_SET1(c)              byte broadcast
+ *   CBS_SHL1(a)              every byte shifted left by one bit
+ *   CBS_MSB(a)               every byte shifted right by seven bits
+ *   CBS_S1..CBS_S4(a)        the four Camellia S-boxes, bytewise
+ *   CBS_LOADT(x, in)         load CBS_BLOCKS blocks, transpose into x[16]
+ *   CBS_STORET(x, out)       transpose x[16] back, store CBS_BLOCKS blocks
+ *
+ * After the transpose x[i] holds byte i of every block, so the whole cipher
+ * is byte arithmetic.  The round structure is the one of camellia_encrypt256()
+ * and camellia_decrypt256() and uses the very same subkey table, so the results
+ * are bit-identical to Camellia_EncryptBlock() / Camellia_DecryptBlock().
+ */
+
+
+/* byte j (0 = most significant) of a 32 bit subkey word, broadcast */
+#define CBS_K(k, j) CBS_SET1((uint8_t)((k) >> (24-8*(j))))
+
+
+/* CAMELLIA_ROUNDSM, x[s..s+7] is the input half, x[d..d+7] gets the result xored in */
+
+static inline void CBS_FUNC_ROUND(CBS_VEC *x, int s, int d, uint32_t kl, uint32_t kr)
+{
+    CBS_VEC a0, a1, a2, a3, b0, b1, b2, b3;
+    CBS_VEC il0, il1, il2, il3, ir0, ir1, ir2, ir3;
+
+    a0 = CBS_S1(x[s+0]);
+    a1 = CBS_S2(x[s+1]);
+    a2 = CBS_S3(x[s+2]);
+    a3 = CBS_S4(x[s+3]);
+    b0 = CBS_S1(x[s+7]);
+    b1 = CBS_S2(x[s+4]);
+    b2 = CBS_S3(x[s+5]);
+    b3 = CBS_S4(x[s+6]);
+
+    /* the SP1110 / SP0222 / SP3033 / SP4404 part of P */
+    il0 = CBS_XOR(CBS_XOR(a0, a2), CBS_XOR(a3, CBS_K(kl, 0)));
+    il1 = CBS_XOR(CBS_XOR(a0, a1), CBS_XOR(a3, CBS_K(kl, 1)));
+    il2 = CBS_XOR(CBS_XOR(a0, a1), CBS_XOR(a2, CBS_K(kl, 2)));
+    il3 = CBS_XOR(CBS_XOR(a1, a2), CBS_XOR(a3, CBS_K(kl, 3)));
+    ir0 = CBS_XOR(CBS_XOR(b0, b2), CBS_XOR(b3, CBS_K(kr, 0)));
+    ir1 = CBS_XOR(CBS_XOR(b0, b1), CBS_XOR(b3, CBS_K(kr, 1)));
+    ir2 = CBS_XOR(CBS_XOR(b0, b1), CBS_XOR(b2, CBS_K(kr, 2)));
+    ir3 = CBS_XOR(CBS_XOR(b1, b2), CBS_XOR(b3, CBS_K(kr, 3)));
+
+    /* ir ^= il; il = CAMELLIA_RR8(il); il ^= ir; */
+    ir0 = CBS_XOR(ir0, il0);
+    ir1 = CBS_XOR(ir1, il1);
+    ir2 = CBS_XOR(ir2, il2);
+    ir3 = CBS_XOR(ir3, il3);
+
+    x[d+0] = CBS_XOR(x[d+0], ir0);
+    x[d+1] = CBS_XOR(x[d+1], ir1);
+    x[d+2] = CBS_XOR(x[d+2], ir2);
+    x[d+3] = CBS_XOR(x[d+3], ir3);
+    x[d+4] = CBS_XOR(x[d+4], CBS_XOR(il3, ir0));
+    x[d+5] = CBS_XOR(x[d+5], CBS_XOR(il0, ir1));
+    x[d+6] = CBS_XOR(x[d+6], CBS_XOR(il1, ir2));
+    x[d+7] = CBS_XOR(x[d+7], CBS_XOR(il2, ir3));
+}
+
+
+/* CAMELLIA_RL1 of the 32 bit word w[0..3], w[0] being the most significant byte */
+
+static inline void CBS_FUNC_RL1(CBS_VEC *r, const CBS_VEC *w)
+{
+    r[0] = CBS_OR(CBS_SHL1(w[0]), CBS_MSB(w[1]));
+    r[1] = CBS_OR(CBS_SHL1(w[1]), CBS_MSB(w[2]));
+    r[2] = CBS_OR(CBS_SHL1(w[2]), CBS_MSB(w[3]));
+    r[3] = CBS_OR(CBS_SHL1(w[3]), CBS_MSB(w[0]));
+}
+
+
+/* CAMELLIA_FLS */
+
+static inline void CBS_FUNC_FLS(CBS_VEC *x, uint32_t kll, uint32_t klr, uint32_t krl, uint32_t krr)
+{
+    CBS_VEC t[4], u[4];
+    int j;
+
+    for(j=0; j<4; j++)
+        t[j] = CBS_AND(x[j], CBS_K(kll, j));
+    CBS_FUNC_RL1(u, t);
+    for(j=0; j<4; j++)
+        x[4+j] = CBS_XOR(x[4+j], u[j]);
+    for(j=0; j<4; j++)
+        x[j] = CBS_XOR(x[j], CBS_OR(x[4+j], CBS_K(klr, j)));
+
+    for(j=0; j<4; j++)
+        x[8+j] = CBS_XOR(x[8+j], CBS_OR(x[12+j], CBS_K(krr, j)));
+    for(j=0; j<4; j++)
+        t[j] = CBS_AND(x[8+j], CBS_K(krl, j));
+    CBS_FUNC_RL1(u, t);
+    for(j=0; j<4; j++)
+        x[12+j] = CBS_XOR(x[12+j], u[j]);
+}
+
+
+static void CBS_FUNC(const uint32_t *subkey, const unsigned char *in, unsigned char *out, int dec)
+{
+    CBS_VEC x[16], t;
+    int r, k, kx, j;
+    const int w0 = dec ? 32 : 0;
+    const int w1 = dec ? 0 : 32;
+
+    CBS_LOADT(x, in);
+
+    /* pre whitening but absorb kw2*/
+    for(j=0; j<4; j++)
+    {
+        x[j] = CBS_XOR(x[j], CBS_K(CamelliaSubkeyL(w0), j));
+        x[4+j] = CBS_XOR(x[4+j], CBS_K(CamelliaSubkeyR(w0), j));
+    }
+
+    /* main iteration, same key order as camellia_256_lanes() */
+    for(r=0; r<4; r++)
+    {
+        if(r>0)
+        {
+            kx = dec ? 33-8*r : 8*r;
+            CBS_FUNC_FLS(x, CamelliaSubkeyL(kx), CamelliaSubkeyR(kx),
+                            CamelliaSubkeyL(dec ? kx-1 : kx+1), CamelliaSubkeyR(dec ? kx-1 : kx+1));
+        }
+        for(k=0; k<6; k+=2)
+        {
+            kx = dec ? 31-8*r-k : 2+8*r+k;
+            CBS_FUNC_ROUND(x, 0, 8, CamelliaSubkeyL(kx), CamelliaSubkeyR(kx));
+            kx = dec ? kx-1 : kx+1;
+            CBS_FUNC_ROUND(x, 8, 0, CamelliaSubkeyL(kx), CamelliaSubkeyR(kx));
+        }
+    }
+
+    /* post whitening but kw4, then swap the halves */
+    for(j=0; j<4; j++)
+    {
+        x[8+j] = CBS_XOR(x[8+j], CBS_K(CamelliaSubkeyL(w1), j));
+        x[12+j] = CBS_XOR(x[12+j], CBS_K(CamelliaSubkeyR(w1), j));
+    }
+    for(j=0; j<8; j++)
+    {
+        t = x[j];
+        x[j] = x[8+j];
+        x[8+j] = t;
+    }
+
+    CBS_STORET(x, out);
+}
+
+
+#undef CBS_K
@@ -0,0 +1,134 @@
+/* camellia_gfni.c - Camellia-256 with GFNI and AVX-512, 64 blocks (kjw)
+ *
+ * gf2p8affineinvqb does an inversion in GF(2^8) followed by an arbitrary
+ * affine map, which is all a Camellia S-box is once the input went through
+ * another affine map:
+ *
+ *     s(x) = affineinv( affine(x, PRE, 0x45), POST, c )
+ *
+ * Two instructions per S-box on 64 bytes, against four table lookups and
+ * an aesenclast in camellia_aesni.c.  The 64 blocks are byte-sliced by
+ * camellia_bslice.h, each 128 bit lane of a __m512i carries 16 of them.
+ *
+ * This file has to be compiled with -mgfni -mavx512f -mavx512bw, otherwise
+ * it compiles to a stub, cpudispatch.c never lets it be called then.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "camellia.h"
+
+#if defined(__GFNI__) && defined(__AVX512F__) && defined(__AVX512BW__)
+
+#include <immintrin.h>
+
+
+#define CamelliaSubkeyL(INDEX) (subkey[(INDEX)*2])
+#define CamelliaSubkeyR(INDEX) (subkey[(INDEX)*2 + 1])
+
+
+/* the bit matrices, see the header comment */
+
+#define CBS_PRE_S123        0xb74c0bcd30253461ULL
+#define CBS_PRE_S4          0xdb2685e618921ab0ULL
+#define CBS_PRE_C           0x45
+#define CBS_POST_S14        0x80667dd8717afe38ULL
+#define CBS_POST_S2         0x3880667dd8717afeULL
+#define CBS_POST_S3         0x667dd8717afe3880ULL
+
+#define CBS_GFNI_SBOX(x, pre, post, c) \
+    _mm512_gf2p8affineinv_epi64_epi8( \
+        _mm512_gf2p8affine_epi64_epi8(x, _mm512_set1_epi64((long long)(pre)), CBS_PRE_C), \
+        _mm512_set1_epi64((long long)(post)), c)
+
+
+static inline void cbs512_transpose(__m512i *a)
+{
+    __m512i b[16];
+    int s, k;
+
+    /* unpack works per 128 bit lane, so this is four 16x16 transposes side by side */
+    for(s=0; s<4; s++)
+    {
+        for(k=0; k<8; k++)
+        {
+            b[2*k]   = _mm512_unpacklo_epi8(a[k], a[k+8]);
+            b[2*k+1] = _mm512_unpackhi_epi8(a[k], a[k+8]);
+        }
+        for(k=0; k<16; k++)
+            a[k] = b[k];
+    }
+}
+
+/* row j carries the blocks j, j+16, j+32 and j+48, one per lane */
+
+static inline void cbs512_loadt(__m512i *x, const unsigned char *in)
+{
+    __m512i v;
+    int j;
+
+#define CBS_LOAD128(b) _mm_loadu_si128((const __m128i *)(in + (b)*CAMELLIA_BLOCK_SIZE))
+    for(j=0; j<16; j++)
+    {
+        v = _mm512_maskz_broadcast_i32x4(0x000f, CBS_LOAD128(j));
+        v = _mm512_mask_broadcast_i32x4(v, 0x00f0, CBS_LOAD128(j+16));
+        v = _mm512_mask_broadcast_i32x4(v, 0x0f00, CBS_LOAD128(j+32));
+        x[j] = _mm512_mask_broadcast_i32x4(v, 0xf000, CBS_LOAD128(j+48));
+    }
+#undef CBS_LOAD128
+    cbs512_transpose(x);
+}
+
+static inline void cbs512_storet(__m512i *x, unsigned char *out)
+{
+    int j;
+
+    cbs512_transpose(x);
+#define CBS_STORE128(b, l) _mm_storeu_si128((__m128i *)(out + (b)*CAMELLIA_BLOCK_SIZE), \
+                                            _mm512_maskz_extracti32x4_epi32(0xf, x[j], l))
+    for(j=0; j<16; j++)
+    {
+        CBS_STORE128(j, 0);
+        CBS_STORE128(j+16, 1);
+        CBS_STORE128(j+32, 2);
+        CBS_STORE128(j+48, 3);
+    }
+#undef CBS_STORE128
+}
+
+#define CBS_VEC             __m512i
+#define CBS_BLOCKS          64
+#define CBS_FUNC            camellia_256_bslice512
+#define CBS_FUNC_ROUND      camellia_256_bslice512_round
+#define CBS_FUNC_RL1        camellia_256_bslice512_rl1
+#define CBS_FUNC_FLS        camellia_256_bslice512_fls
+#define CBS_XOR(a,b)        _mm512_xor_si512(a, b)
+#define CBS_AND(a,b)        _mm512_and_si512(a, b)
+#define CBS_OR(a,b)         _mm512_or_si512(a, b)
+#define CBS_SET1(c)         _mm512_set1_epi8((char)(c))
+#define CBS_SHL1(a)         _mm512_add_epi8(a, a)
+#define CBS_MSB(a)          _mm512_and_si512(_mm512_srli_epi16(a, 7), _mm512_set1_epi8(1))
+#define CBS_S1(a)           CBS_GFNI_SBOX(a, CBS_PRE_S123, CBS_POST_S14, 0x6e)
+#define CBS_S2(a)           CBS_GFNI_SBOX(a, CBS_PRE_S123, CBS_POST_S2, 0xdc)
+#define CBS_S3(a)           CBS_GFNI_SBOX(a, CBS_PRE_S123, CBS_POST_S3, 0x37)
+#define CBS_S4(a)           CBS_GFNI_SBOX(a, CBS_PRE_S4, CBS_POST_S14, 0x6e)
+#define CBS_LOADT(x, in)    cbs512_loadt(x, in)
+#define CBS_STORET(x, out)  cbs512_storet(x, out)
+
+#include "camellia_bslice.h"
+
+
+void camellia_256_x64_gfni(const KeyTableType *keyTable, const unsigned char *in, unsigned char *out, int dec)
+{
+    camellia_256_bslice512(keyTable, in, out, dec);
+}
+
+#else
+
+void camellia_256_x64_gfni(const KeyTableType *keyTable, const unsigned char *in, unsigned char *out, int dec)
+{
+    abort();
+}
+
+#endif
@@ -1,5 +1,8 @@
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -39,3 +42,44 @@ short getcpus(void)
         numCPU = 1;
     return numCPU;
 }
+
+
+/* no vmsplice here, the pipeline writes with writearr() then */
+
+int     pipe_enlarge(int fd, int want)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int     pipe_unread(int fd)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int64_t vmsplicearr(int fd, const void *buf, uint64_t bufsz)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int64_t splicearr(int fd, int outfd, void *buf, uint64_t off, uint64_t bufsz, uint64_t *waitns)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+/* fdescfs has it, without that /dev/fd only knows 0, 1 and 2 and dups them */
+
+int     reopen_rdonly(int fd)
+{
+    char path[32];
+
+    snprintf(path, sizeof path, "/dev/fd/%d", fd);
+    return open(path, O_RDONLY|O_CLOEXEC);
+}
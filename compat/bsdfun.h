@@ -1,5 +1,13 @@
 
+#include <stdint.h>
+
 
 ssize_t getrandom(void *buf, size_t buflen, unsigned int flags);
 
 short getcpus(void);
+
+int     pipe_enlarge(int fd, int want);
+int     pipe_unread(int fd);
+int64_t vmsplicearr(int fd, const void *buf, uint64_t bufsz);
+int64_t splicearr(int fd, int outfd, void *buf, uint64_t off, uint64_t bufsz, uint64_t *waitns);
+int     reopen_rdonly(int fd);
@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/param.h>
 
 #include "buftools.h"
 
@@ -129,30 +131,57 @@ int64_t readarr(int fd, void *buf, uint64_t bufsz)
 
 int64_t writearr(int fd, void *buf, uint64_t bufsz)
 {
-    uint32_t n, num;
     uint64_t total = 0;
-    size_t r;
+    ssize_t r;
 
-    if(bufsz>GRANULARITY)
+    /* a pipe may take less than asked for, when a signal or task work comes in between */
+    while(total<bufsz)
     {
-        num = bufsz/GRANULARITY;
-        bufsz %= GRANULARITY;
-        for(n=0; n<num; n++)
-        {
-            r = write(fd, (void *)((uint8_t *)buf+(uint64_t)n*GRANULARITY), GRANULARITY);
-            if(r==0)
-                return total;
-            if(r<0)
-                return -1;
-            total+=r;
-            if(r<GRANULARITY)
-                break;
-        }
-        if(!bufsz)
-            return total;
+        r = write(fd, (uint8_t *)buf+total, MIN(bufsz-total, GRANULARITY));
+        if(r<0 && errno==EINTR)
+            continue;
+        if(r<=0)
+            return total ? (int64_t)total : -1;
+        total += r;
     }
-    r = write(fd, (uint8_t *)buf+total, bufsz);
-    return (r<0) ? (-1) : (r+total);
+    return total;
+}
+
+
+/* positioned, they don't move the file offset, so several threads can share fd */
+
+int64_t preadarr(int fd, void *buf, uint64_t bufsz, uint64_t off)
+{
+    uint64_t total = 0;
+    ssize_t r;
+
+    while(total<bufsz)
+    {
+        r = pread(fd, (uint8_t *)buf+total, bufsz-total, off+total);
+        if(r==0)
+            /* eof */
+            break;
+        if(r<0)
+            return -1;
+        total += r;
+    }
+    return total;
+}
+
+
+int64_t pwritearr(int fd, const void *buf, uint64_t bufsz, uint64_t off)
+{
+    uint64_t total = 0;
+    ssize_t r;
+
+    while(total<bufsz)
+    {
+        r = pwrite(fd, (const uint8_t *)buf+total, bufsz-total, off+total);
+        if(r<=0)
+            return -1;
+        total += r;
+    }
+    return total;
 }
 
 
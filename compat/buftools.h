@@ -20,6 +20,9 @@ int32_t read_blocking(int fd, void *buf0, uint32_t count);
 int64_t readarr(int fd, void *buf, uint64_t bufsz);
 int64_t writearr(int fd, void *buf, uint64_t bufsz);
 
+int64_t preadarr(int fd, void *buf, uint64_t bufsz, uint64_t off);
+int64_t pwritearr(int fd, const void *buf, uint64_t bufsz, uint64_t off);
+
 const char *getenv_fb(const char *name, const char *fallback);
 
 #define MEMASSERT(ptr)  { if(!(ptr)) {oom(__FILE__,__LINE__);}}
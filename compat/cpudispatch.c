@@ -0,0 +1,96 @@
+
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cpudispatch.h"
+
+
+/*
+ * The binary itself is built for the baseline of the architecture, only the
+ * kernel objects get -msse4.1/-mavx2/-mavx512f (see Makefile.linux).  Which
+ * of them may run is decided here, once, from CPUID.  SOTPET_DISPATCH=1 says
+ * the kernels are in there at all, without it everything stays scalar.
+ *
+ * The environment (SORBET_ISA) can lower the level, never raise it.
+ */
+
+
+int cpu_isa = -1;
+int cpu_has_aes = 0;
+int cpu_has_gfni = 0;
+
+static const char *isanames[] = { "scalar", "sse4", "avx2", "avx512" };
+static char desc[64];
+
+
+static int detect(void)
+{
+    int isa = ISA_SCALAR;
+
+#if SOTPET_DISPATCH && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("ssse3"))
+    {
+        isa = ISA_SSE4;
+        if(__builtin_cpu_supports("avx2"))
+        {
+            isa = ISA_AVX2;
+            if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+                isa = ISA_AVX512;
+        }
+    }
+    cpu_has_aes = __builtin_cpu_supports("aes");
+    cpu_has_gfni = __builtin_cpu_supports("gfni");
+#endif
+    return isa;
+}
+
+
+int         cpu_dispatch_init(const char *isaname)
+{
+    int isa, i;
+
+    if(cpu_isa>=0 && !isaname)
+        return cpu_isa;
+
+    isa = detect();
+    if(isaname && *isaname)
+    {
+        for(i=ISA_SCALAR; i<=ISA_AVX512; i++)
+            if(!strcmp(isaname, isanames[i]))
+                break;
+        if(i>ISA_AVX512)
+            fprintf(stderr, "SORBET_ISA=%s: not recognized, using %s\n", isaname, isanames[isa]);
+        else
+            if(i>isa)
+                fprintf(stderr, "SORBET_ISA=%s: not supported, using %s\n", isaname, isanames[isa]);
+            else
+                isa = i;
+    }
+    if(isa<ISA_SSE4)
+        cpu_has_aes = 0;
+    if(isa<ISA_AVX512)
+        cpu_has_gfni = 0;
+
+    snprintf(desc, sizeof(desc), "%s%s%s", isanames[isa], cpu_has_aes ? "+aes" : "", cpu_has_gfni ? "+gfni" : "");
+    cpu_isa = isa;
+    return isa;
+}
+
+
+const char *cpu_isa_name(int isa)
+{
+    if(isa<ISA_SCALAR || isa>ISA_AVX512)
+        return "none";
+    return isanames[isa];
+}
+
+
+const char *cpu_dispatch_desc(void)
+{
+    if(cpu_isa<0)
+        cpu_dispatch_init(NULL);
+    return desc;
+}
@@ -0,0 +1,23 @@
+
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+/* runtime selection of the vector kernels, see cpudispatch.c */
+
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#define ISA_SCALAR      0
+#define ISA_SSE4        1
+#define ISA_AVX2        2
+#define ISA_AVX512      3
+
+/* -1 until cpu_dispatch_init() ran, so everything falls back to scalar code */
+extern int cpu_isa;
+extern int cpu_has_aes;
+extern int cpu_has_gfni;
+
+int         cpu_dispatch_init(const char *isaname);
+const char *cpu_isa_name(int isa);
+const char *cpu_dispatch_desc(void);
+
+#endif
@@ -1,7 +1,140 @@
 
+#include <stdint.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "linuxfun.h"
 
 short getcpus(void)
 {
     return sysconf(_SC_NPROCESSORS_ONLN);;
 }
+
+
+/* make a pipe hold want bytes, or as much as pipe-max-size lets us; -1 if fd is no pipe */
+
+int     pipe_enlarge(int fd, int want)
+{
+    struct stat st;
+    int cur, r;
+
+    if(fstat(fd, &st) || !S_ISFIFO(st.st_mode))
+        return -1;
+    cur = fcntl(fd, F_GETPIPE_SZ);
+    for(; want>cur; want/=2)
+    {
+        r = fcntl(fd, F_SETPIPE_SZ, want);
+        if(r>=0)
+            return r;
+    }
+    return cur;
+}
+
+
+/* bytes in the pipe the other end hasn't read yet */
+
+int     pipe_unread(int fd)
+{
+    int n;
+
+    if(ioctl(fd, FIONREAD, &n)<0)
+        return -1;
+    return n;
+}
+
+
+/*
+ * like writearr(), but the pipe takes references to the pages instead of
+ * a copy.  buf must not be touched until the reader has taken it all out
+ * of the pipe, see pipe_unread().
+ */
+
+int64_t vmsplicearr(int fd, const void *buf, uint64_t bufsz)
+{
+    struct iovec iov;
+    uint64_t total = 0;
+    ssize_t r;
+
+    while(total<bufsz)
+    {
+        iov.iov_base = (uint8_t *)buf+total;
+        iov.iov_len = bufsz-total;
+        r = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+        if(r<0 && errno==EINTR)
+            continue;
+        if(r<=0)
+            return total ? (int64_t)total : -1;
+        total += r;
+    }
+    return total;
+}
+
+
+/*
+ * fill bufsz bytes from the pipe fd, short only at eof.  outfd is the file
+ * behind the mapping buf (a SotpetSharedMem) and gets the pages with splice()
+ * at off, without it or if the file won't take them it's read() into buf.
+ * The time spent waiting for the other end of the pipe is added to *waitns.
+ */
+
+int64_t splicearr(int fd, int outfd, void *buf, uint64_t off, uint64_t bufsz, uint64_t *waitns)
+{
+    struct pollfd pfd;
+    struct timespec t0, t1;
+    uint64_t total = 0;
+    loff_t o;
+    ssize_t r;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while(total<bufsz)
+    {
+        if(poll(&pfd, 1, 0)==0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            while(poll(&pfd, 1, -1)<0 && errno==EINTR)
+                ;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            *waitns += (t1.tv_sec-t0.tv_sec)*1000000000LL + t1.tv_nsec-t0.tv_nsec;
+        }
+        if(outfd>=0)
+        {
+            o = off+total;
+            r = splice(fd, NULL, outfd, &o, bufsz-total, SPLICE_F_MOVE);
+            if(r<0 && errno==EINVAL)
+            {
+                outfd = -1;
+                continue;
+            }
+        }
+        else
+            r = read(fd, (uint8_t *)buf+total, bufsz-total);
+        if(r<0 && errno==EINTR)
+            continue;
+        if(r==0)
+            /* eof */
+            break;
+        if(r<0)
+            return -1;
+        total += r;
+    }
+    return total;
+}
+
+
+/* the file behind fd once more, for reading, even if fd was opened O_WRONLY */
+
+int     reopen_rdonly(int fd)
+{
+    char path[32];
+
+    snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY|O_CLOEXEC);
+}
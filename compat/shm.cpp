@@ -1,4 +1,3 @@
-
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
@@ -13,90 +12,201 @@
 #include "shm.hpp"
 
 
-                            SotpetSharedMem::SotpetSharedMem(uint64_t id, size_t sz, bool cr)
+#define PAGESIZE        4096
+#define HUGEPAGESIZE    (2UL<<20)
+
+#define ROUNDUP(x, a)   (((x)+(a)-1)/(a)*(a))
+
+
+/*
+ * The arena used to be one shm_open("/SOTPET_<n>") object per buffer,
+ * mapped on first use, with n counting from 0 in every process.  Now it's
+ * all in one piece of memory without a name, tried in this order:
+ *
+ *   - memfd with MFD_HUGETLB, if it's at least a huge page and the admin
+ *     has reserved some (vm.nr_hugepages); it keeps a file for splice()
+ *   - anonymous memory with MADV_HUGEPAGE, transparent huge pages if the
+ *     kernel is set to always or madvise, no file then
+ *
+ * Only the address space is set aside here.  The pages of a buffer are
+ * faulted in all at once when take() hands it out, not in the middle of
+ * the cipher loop, and a buffer that is never taken costs nothing.
+ */
+
+/* room for n buffers of sz */
+
+                            SotpetArena::SotpetArena(size_t sz, int n)
 {
-    int r;
+    uint8_t *p;
+    size_t extra;
+    char name[32];
 
-    this->id = id;
-    sprintf(this->shmfnbuf, SHM_NAME, id);
+    this->len = n*ROUNDUP(sz, PAGESIZE);
 
-    //fprintf(stderr, "SHM: %s cr=%d\n", this->shmfnbuf, cr /* = true */);
+#if !BSD && defined(MFD_HUGETLB)
+    if(this->len>=HUGEPAGESIZE)
+    {
+        /* the name only shows in /proc/<pid>/maps, it needn't be unique */
+        snprintf(name, sizeof name, "sotpet-%d", (int)getpid());
+        this->fd = memfd_create(name, MFD_CLOEXEC|MFD_HUGETLB);
+        if(this->fd>=0)
+        {
+            p = (uint8_t *)MAP_FAILED;
+            if(!ftruncate(this->fd, ROUNDUP(this->len, HUGEPAGESIZE)))
+                p = (uint8_t *)mmap(NULL, ROUNDUP(this->len, HUGEPAGESIZE), PROT_READ|PROT_WRITE, MAP_SHARED, this->fd, 0);
+            if(p!=MAP_FAILED)
+            {
+                this->len = ROUNDUP(this->len, HUGEPAGESIZE);
+                this->base = p;
+                this->huge = true;
+                return;
+            }
+            close(this->fd);
+            this->fd = -1;
+        }
+    }
+#endif
 
-    this->shmf = shm_open(this->shmfnbuf, O_RDWR | (cr?(O_CREAT|O_TRUNC):0), 0600);
-    if(this->shmf<0)
+    /* one huge page more, so the start can be aligned to one */
+    extra = this->len>=HUGEPAGESIZE ? HUGEPAGESIZE : 0;
+    p = (uint8_t *)mmap(NULL, this->len+extra, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(p==MAP_FAILED)
     {
-        perror(this->shmfnbuf);
+        perror("arena");
         throw std::runtime_error("i/o");
     }
-    this->buflen = sz;
-    if(cr)
+    if(extra)
     {
-        r = ftruncate(this->shmf, this->buflen);
-        if(r<0)
-        {
-            perror(this->shmfnbuf);
-            throw std::runtime_error("i/o");
-        }
+        this->base = (uint8_t *)ROUNDUP((uintptr_t)p, HUGEPAGESIZE);
+        if(this->base>p)
+            munmap(p, this->base-p);
+        munmap(this->base+this->len, p+extra-this->base);
+#ifdef MADV_HUGEPAGE
+        this->huge = !madvise(this->base, this->len, MADV_HUGEPAGE);
+#endif
     }
+    else
+        this->base = p;
 }
 
 
-                            SotpetSharedMem::SotpetSharedMem(uint64_t id, void *buf, size_t sz)
+                           SotpetArena::~SotpetArena()
+{
+    if(this->base && munmap(this->base, this->len)<0)
+        perror("arena");
+    if(this->fd>=0)
+        close(this->fd);
+}
+
+
+/* the next sz bytes, page aligned; off is where they are in the file behind getfd() */
+
+            uint8_t        *SotpetArena::take(size_t sz, size_t *off)
+{
+    uint8_t *p;
+
+    sz = ROUNDUP(sz, PAGESIZE);
+    if(this->used+sz>this->len)
+        throw std::runtime_error("arena full");
+    p = this->base+this->used;
+    *off = this->used;
+    this->used += sz;
+
+#ifdef MADV_POPULATE_WRITE
+    if(!madvise(p, sz, MADV_POPULATE_WRITE))
+        return p;
+#endif
+    for(size_t i=0; i<sz; i+=PAGESIZE)
+        p[i] = 0;
+    return p;
+}
+
+
+            int             SotpetArena::getfd()
+{
+    return this->fd;
+}
+
+
+            bool            SotpetArena::ishuge()
+{
+    return this->huge;
+}
+
+
+            uint8_t        *SotpetArena::getbase()
+{
+    return this->base;
+}
+
+
+            size_t          SotpetArena::getlen()
 {
-    int r;
+    return this->len;
+}
+
+
+/* a buffer with an arena of its own */
 
+                            SotpetSharedMem::SotpetSharedMem(uint64_t id, size_t sz, bool cr)
+{
     this->id = id;
-    sprintf(this->shmfnbuf, SHM_NAME, id);
+    this->buflen = sz;
+    this->arena = new SotpetArena(sz);
+    this->ownarena = true;
+    this->buf = this->arena->take(sz, &this->off);
+}
 
-    //fprintf(stderr, "SHM: %s cr=%d\n", this->shmfnbuf, cr /* = true */);
 
-    this->shmf = shm_open(this->shmfnbuf, O_RDWR | O_CREAT|O_TRUNC, 0600);
-    if(this->shmf<0)
-    {
-        perror(this->shmfnbuf);
-        throw std::runtime_error("i/o");
-    }
+                            SotpetSharedMem::SotpetSharedMem(uint64_t id, void *buf, size_t sz)
+    : SotpetSharedMem(id, sz, true)
+{
+    memcpy(this->buf, buf, sz);
+}
+
+
+/* a buffer cut from a shared arena, which must outlive it */
+
+                            SotpetSharedMem::SotpetSharedMem(uint64_t id, SotpetArena *arena, size_t sz)
+{
+    this->id = id;
     this->buflen = sz;
-    r = ftruncate(this->shmf, this->buflen);
-    if(r<0)
-    {
-        perror(this->shmfnbuf);
-        throw std::runtime_error("i/o");
-    }
-    memcpy(this->getbuf(), buf, sz);
+    this->arena = arena;
+    this->buf = arena->take(sz, &this->off);
 }
 
 
                            SotpetSharedMem::~SotpetSharedMem()
 {
-    int r;
-
-    if(this->buf)
-    {
-        r=munmap(this->buf, this->buflen);
-        if(r<0)
-        {
-            perror(this->shmfnbuf);
-        }
-        this->buf=NULL;
-    }
-    if(this->shmf>=0)
-    {
-        r=shm_unlink(this->shmfnbuf);
-        if(r<0)
-        {
-            perror(this->shmfnbuf);
-        }
-        this->shmf=-1;
-    }
+    if(this->ownarena)
+        delete this->arena;
+    this->buf = NULL;
 }
 
 
             uint8_t        *SotpetSharedMem::getbuf()
 {
-    if(!this->buf)
-        this->buf = mmap(NULL, this->buflen, PROT_READ|PROT_WRITE, MAP_SHARED, this->shmf, 0);
-    return (uint8_t *)this->buf;
+    return this->buf;
+}
+
+
+            size_t          SotpetSharedMem::getsize()
+{
+    return this->buflen;
+}
+
+
+/* -1 if there is no file behind the memory, see SotpetArena */
+
+            int             SotpetSharedMem::getfd()
+{
+    return this->arena->getfd();
+}
+
+
+            size_t          SotpetSharedMem::getoff()
+{
+    return this->off;
 }
 
 
@@ -1,20 +1,50 @@
 
-#include "sotpet_shm.h"
+
+/*
+ * One mapping the buffers of a pipeline are cut from, in huge pages if
+ * the system has any to give and pre-faulted, see shm.cpp.  There is no
+ * name in /dev/shm any more, so nothing two instances could share and
+ * nothing a crash could leave behind.
+ */
+
+class SotpetArena
+    {
+        protected:
+            int             fd = -1;
+            size_t          len = 0,
+                            used = 0;
+            uint8_t        *base = NULL;
+            bool            huge = false;
+
+        public:
+                            SotpetArena(size_t sz, int n=1);
+                           ~SotpetArena();
+            uint8_t        *take(size_t sz, size_t *off);
+            int             getfd();
+            bool            ishuge();
+            uint8_t        *getbase();
+            size_t          getlen();
+    };
 
 
 class SotpetSharedMem
     {
         protected:
             uint64_t        id;
-            int             shmf = -1;
             size_t          buflen;
-            void           *buf = NULL;
-            char            shmfnbuf[SHM_NAME_SIZE];
+            uint8_t        *buf = NULL;
+            SotpetArena    *arena = NULL;
+            bool            ownarena = false;
+            size_t          off = 0;
 
         public:
                             SotpetSharedMem(uint64_t id, size_t sz, bool cr=true);
                             SotpetSharedMem(uint64_t id, void *buf, size_t sz);
+                            SotpetSharedMem(uint64_t id, SotpetArena *arena, size_t sz);
                            ~SotpetSharedMem();
             uint8_t        *getbuf();
+            size_t          getsize();
+            int             getfd();
+            size_t          getoff();
             uint64_t        getid();
     };
@@ -0,0 +1,235 @@
+
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "uring.h"
+
+
+/*
+ * A minimal io_uring without liburing: one submission ring, one
+ * completion ring, reads and writes at explicit offsets, optionally on
+ * registered buffers.  Each ring belongs to one thread.  SOTPET_URING=1
+ * (Makefile.linux) says the kernel header is there, without it every
+ * call fails with ENOSYS and the callers stay with readarr()/writearr().
+ *
+ * The environment (SORBET_URING=0) switches it off, so does a kernel or
+ * a seccomp profile that doesn't let io_uring_setup() through.
+ */
+
+
+int uring_enabled = -1;
+
+
+#if SOTPET_URING && defined(__linux__)
+
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, const void *arg, unsigned n)
+{
+    return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+
+int         uring_probe(const char *setting)
+{
+    struct uring u;
+
+    if(uring_enabled>=0 && !setting)
+        return uring_enabled;
+    uring_enabled = 0;
+    if(setting && *setting && !atoi(setting))
+        return 0;
+    if(!uring_init(&u, 2))
+    {
+        uring_exit(&u);
+        uring_enabled = 1;
+    }
+    return uring_enabled;
+}
+
+
+int         uring_init(struct uring *u, unsigned entries)
+{
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+
+    memset(u, 0, sizeof *u);
+    memset(&p, 0, sizeof p);
+    u->fd = sys_setup(entries, &p);
+    if(u->fd<0)
+        return errno;
+    u->entries = p.sq_entries;
+
+    u->sqringsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    u->cqringsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    u->sqessize = p.sq_entries*sizeof(struct io_uring_sqe);
+    u->sqring = mmap(NULL, u->sqringsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cqring = mmap(NULL, u->cqringsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqessize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqring==MAP_FAILED || u->cqring==MAP_FAILED || u->sqes==MAP_FAILED)
+    {
+        uring_exit(u);
+        return ENOMEM;
+    }
+
+    sq = (uint8_t *)u->sqring;
+    cq = (uint8_t *)u->cqring;
+    u->sqhead = (unsigned *)(sq + p.sq_off.head);
+    u->sqtail = (unsigned *)(sq + p.sq_off.tail);
+    u->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sqarray = (unsigned *)(sq + p.sq_off.array);
+    u->cqhead = (unsigned *)(cq + p.cq_off.head);
+    u->cqtail = (unsigned *)(cq + p.cq_off.tail);
+    u->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = cq + p.cq_off.cqes;
+    return 0;
+}
+
+
+/* the buffers get pinned, if RLIMIT_MEMLOCK says no we go on without */
+
+int         uring_register(struct uring *u, const struct iovec *iov, unsigned n)
+{
+    if(sys_register(u->fd, IORING_REGISTER_BUFFERS, iov, n)<0)
+        return errno;
+    u->fixed = 1;
+    return 0;
+}
+
+
+/* bufidx is the index in the registered iovecs or -1, off=-1 is the file position */
+
+int         uring_prep(struct uring *u, bool wr, int fd, void *buf, uint32_t len, uint64_t off, int bufidx, uint64_t tag)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *u->sqtail, i;
+
+    if(tail - __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE) >= u->entries)
+        return EBUSY;
+    i = tail & *u->sqmask;
+    sqe = (struct io_uring_sqe *)u->sqes + i;
+    memset(sqe, 0, sizeof *sqe);
+    if(u->fixed && bufidx>=0)
+    {
+        sqe->opcode = wr ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = bufidx;
+    }
+    else
+        sqe->opcode = wr ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = tag;
+    u->sqarray[i] = i;
+    __atomic_store_n(u->sqtail, tail+1, __ATOMIC_RELEASE);
+    u->queued++;
+    return 0;
+}
+
+
+/* hand over what's queued and wait until at least wait completions are there */
+
+int         uring_submit(struct uring *u, unsigned wait)
+{
+    int r;
+
+    do
+        r = sys_enter(u->fd, u->queued, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    while(r<0 && errno==EINTR);
+    if(r<0)
+        return errno;
+    u->inflight += r;
+    u->queued -= r;
+    return 0;
+}
+
+
+bool        uring_reap(struct uring *u, uint64_t *tag, int32_t *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head = *u->cqhead;
+
+    if(head == __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE))
+        return 0;
+    cqe = (struct io_uring_cqe *)u->cqes + (head & *u->cqmask);
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(u->cqhead, head+1, __ATOMIC_RELEASE);
+    u->inflight--;
+    return 1;
+}
+
+
+void        uring_exit(struct uring *u)
+{
+    if(u->sqes && u->sqes!=MAP_FAILED)
+        munmap(u->sqes, u->sqessize);
+    if(u->cqring && u->cqring!=MAP_FAILED)
+        munmap(u->cqring, u->cqringsize);
+    if(u->sqring && u->sqring!=MAP_FAILED)
+        munmap(u->sqring, u->sqringsize);
+    if(u->fd>0)
+        close(u->fd);
+    memset(u, 0, sizeof *u);
+}
+
+
+#else
+
+
+int         uring_probe(const char *setting)
+{
+    return uring_enabled = 0;
+}
+
+int         uring_init(struct uring *u, unsigned entries)
+{
+    memset(u, 0, sizeof *u);
+    return ENOSYS;
+}
+
+int         uring_register(struct uring *u, const struct iovec *iov, unsigned n)
+{
+    return ENOSYS;
+}
+
+int         uring_prep(struct uring *u, bool wr, int fd, void *buf, uint32_t len, uint64_t off, int bufidx, uint64_t tag)
+{
+    return ENOSYS;
+}
+
+int         uring_submit(struct uring *u, unsigned wait)
+{
+    return ENOSYS;
+}
+
+bool        uring_reap(struct uring *u, uint64_t *tag, int32_t *res)
+{
+    return 0;
+}
+
+void        uring_exit(struct uring *u)
+{
+}
+
+#endif
@@ -0,0 +1,49 @@
+
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+/* just enough io_uring for the pipeline, straight on the syscalls, see uring.c */
+
+#ifndef URING_H
+#define URING_H
+
+#include <sys/uio.h>
+
+struct uring
+  {
+    int                     fd;
+    unsigned                entries;
+    bool                    fixed;           /* buffers are registered */
+
+    unsigned               *sqhead,
+                           *sqtail,
+                           *sqmask,
+                           *sqarray;
+    void                   *sqes;
+    unsigned               *cqhead,
+                           *cqtail,
+                           *cqmask;
+    void                   *cqes;
+
+    void                   *sqring,
+                           *cqring;
+    size_t                  sqringsize,
+                            cqringsize,
+                            sqessize;
+
+    unsigned                queued;          /* prepared, not yet handed to the kernel */
+    unsigned                inflight;        /* handed to the kernel, not yet reaped */
+  };
+
+/* -1 until uring_probe() ran */
+extern int uring_enabled;
+
+int         uring_probe(const char *setting);
+
+int         uring_init(struct uring *u, unsigned entries);
+int         uring_register(struct uring *u, const struct iovec *iov, unsigned n);
+int         uring_prep(struct uring *u, bool wr, int fd, void *buf, uint32_t len, uint64_t off, int bufidx, uint64_t tag);
+int         uring_submit(struct uring *u, unsigned wait);
+bool        uring_reap(struct uring *u, uint64_t *tag, int32_t *res);
+void        uring_exit(struct uring *u);
+
+#endif
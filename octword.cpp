@@ -6,6 +6,12 @@
 #include <string.h>
 
 #include "octword.hpp"
+#include "cpudispatch.h"
+
+#if SOTPET_DISPATCH && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define XOR_VARIANTS 1
+#endif
 
 
 
@@ -143,3 +149,81 @@ void OctWord::print(FILE *f)
     for(i=15; i>=0; i--)
         fprintf(f, "%02x", (unsigned) this->u.buf[i]);
 }
+
+
+/*
+ * bulk XOR of whole OctWords, one variant per ISA level.  The vector
+ * variants carry their own target attribute, so this file is still built
+ * for the baseline and the matching one is picked from cpu_isa.
+ */
+
+static void xor_n_scalar(uint8_t *dst, const uint8_t *src, uint32_t nwords)
+{
+    uint64_t a[2], b[2];
+
+    for(; nwords>0; nwords--, dst+=16, src+=16)
+    {
+        memcpy(a, dst, 16);
+        memcpy(b, src, 16);
+        a[0] ^= b[0];
+        a[1] ^= b[1];
+        memcpy(dst, a, 16);
+    }
+}
+
+
+#if XOR_VARIANTS
+
+__attribute__((target("sse4.1")))
+static void xor_n_sse4(uint8_t *dst, const uint8_t *src, uint32_t nwords)
+{
+    for(; nwords>0; nwords--, dst+=16, src+=16)
+        _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(_mm_loadu_si128((const __m128i *)dst),
+                                                        _mm_loadu_si128((const __m128i *)src)));
+}
+
+
+__attribute__((target("avx2")))
+static void xor_n_avx2(uint8_t *dst, const uint8_t *src, uint32_t nwords)
+{
+    for(; nwords>=2; nwords-=2, dst+=32, src+=32)
+        _mm256_storeu_si256((__m256i *)dst, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)dst),
+                                                             _mm256_loadu_si256((const __m256i *)src)));
+    if(nwords)
+        _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(_mm_loadu_si128((const __m128i *)dst),
+                                                        _mm_loadu_si128((const __m128i *)src)));
+}
+
+
+__attribute__((target("avx512f")))
+static void xor_n_avx512(uint8_t *dst, const uint8_t *src, uint32_t nwords)
+{
+    __mmask8 m;
+
+    for(; nwords>=4; nwords-=4, dst+=64, src+=64)
+        _mm512_storeu_si512((void *)dst, _mm512_xor_si512(_mm512_loadu_si512((const void *)dst),
+                                                          _mm512_loadu_si512((const void *)src)));
+    if(nwords)
+    {
+        /* the rest is 1..3 OctWords, two quadwords each */
+        m = (__mmask8)((1u << (2*nwords)) - 1);
+        _mm512_mask_storeu_epi64((void *)dst, m, _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, (const void *)dst),
+                                                                  _mm512_maskz_loadu_epi64(m, (const void *)src)));
+    }
+}
+
+#endif
+
+
+void OctWord::xor_n(uint8_t *dst, const uint8_t *src, uint32_t nwords)
+{
+#if XOR_VARIANTS
+    switch(cpu_isa)
+    {
+        case ISA_AVX512: xor_n_avx512(dst, src, nwords); return;
+        case ISA_AVX2:   xor_n_avx2(dst, src, nwords);   return;
+        case ISA_SSE4:   xor_n_sse4(dst, src, nwords);   return;
+    }
+#endif
+    xor_n_scalar(dst, src, nwords);
+}
@@ -22,5 +22,8 @@ class OctWord
             void print(FILE *f);
 
             static unsigned mysize() {return 128;}
+
+            /* dst[i] ^= src[i] for nwords OctWords, vectorized, see cpudispatch.c */
+            static void xor_n(uint8_t *dst, const uint8_t *src, uint32_t nwords);
     };
 
@@ -0,0 +1,113 @@
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "buftools.h"
+#include "sectorcache.hpp"
+
+
+/*
+class SectorCache
+    {
+        protected:
+
+            uint32_t            blocksize,
+                                capacity,
+                                used;
+            uint8_t            *data;
+            std::vector<uint64_t> sector;
+            std::list<uint32_t> lru;
+            std::vector<std::list<uint32_t>::iterator> pos;
+            std::unordered_map<uint64_t, uint32_t> index;
+*/
+
+/*
+ * The slots are taken in order until all are used, after that put() takes
+ * the one at the back of lru.  Moving a slot to the front is a splice, so
+ * neither get() nor put() allocates once the cache is full.
+ */
+
+                SectorCache::SectorCache(uint32_t blocksize, uint32_t capacity)
+{
+    this->blocksize = blocksize;
+    this->capacity = capacity;
+    this->used = 0;
+    this->data = (uint8_t *)malloc((size_t)capacity * blocksize);
+    MEMASSERT(this->data || !capacity)
+    this->sector.resize(capacity);
+    this->pos.resize(capacity);
+    this->index.reserve(capacity);
+}
+
+
+                SectorCache::~SectorCache()
+{
+    /* plaintext, don't leave it around */
+    if(this->data)
+        memset(this->data, 0, (size_t)this->capacity * this->blocksize);
+    free(this->data);
+}
+
+
+/* without making it more recent */
+
+bool            SectorCache::has(uint64_t b)
+{
+    return this->index.count(b)>0;
+}
+
+
+/* NULL if b isn't there, else it is the most recent one now */
+
+const uint8_t  *SectorCache::get(uint64_t b)
+{
+    std::unordered_map<uint64_t, uint32_t>::iterator it = this->index.find(b);
+    uint32_t i;
+
+    if(it==this->index.end())
+        return NULL;
+    i = it->second;
+    this->lru.splice(this->lru.begin(), this->lru, this->pos[i]);
+    return this->data + (size_t)i * this->blocksize;
+}
+
+
+void            SectorCache::put(uint64_t b, const uint8_t *plain)
+{
+    std::unordered_map<uint64_t, uint32_t>::iterator it;
+    uint32_t i;
+
+    if(!this->capacity)
+        return;
+    it = this->index.find(b);
+    if(it!=this->index.end())
+    {
+        i = it->second;
+        this->lru.splice(this->lru.begin(), this->lru, this->pos[i]);
+    }
+    else if(this->used<this->capacity)
+    {
+        i = this->used++;
+        this->lru.push_front(i);
+        this->pos[i] = this->lru.begin();
+        this->index[b] = i;
+    }
+    else
+    {
+        i = this->lru.back();
+        this->lru.splice(this->lru.begin(), this->lru, this->pos[i]);
+        this->index.erase(this->sector[i]);
+        this->index[b] = i;
+    }
+    this->sector[i] = b;
+    memcpy(this->data + (size_t)i * this->blocksize, plain, this->blocksize);
+}
+
+
+uint32_t        SectorCache::getcapacity()
+{
+    return this->capacity;
+}
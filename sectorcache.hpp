@@ -0,0 +1,32 @@
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+
+/* decrypted sectors by number for sotpet_read_at(), the least recently used one goes first */
+
+class SectorCache
+    {
+        protected:
+
+            uint32_t            blocksize,
+                                capacity,
+                                used;
+            uint8_t            *data;                   // capacity sectors
+            std::vector<uint64_t> sector;               // which one a slot holds
+            std::list<uint32_t> lru;                    // slots, the most recent in front
+            std::vector<std::list<uint32_t>::iterator> pos;
+            std::unordered_map<uint64_t, uint32_t> index;
+
+        public:
+
+            SectorCache(uint32_t blocksize, uint32_t capacity);
+            ~SectorCache();
+
+            bool            has(uint64_t b);
+            const uint8_t  *get(uint64_t b);
+            void            put(uint64_t b, const uint8_t *plain);
+            uint32_t        getcapacity();
+    };
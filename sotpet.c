@@ -7,6 +7,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "sotpet.h"
 #include "whirlpool.h"
@@ -15,10 +17,15 @@
 #include "buftools.h"
 #include "octword.hpp"
 #include "shm.hpp"
+#include "threadpool.hpp"
+#include "sectorcache.hpp"
+#include "cpudispatch.h"
 #include "sotpet_private.h"
 
 
 static void *myprocess(void *data);
+static struct sotpet_workset *addset(struct sotpet_container *w, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr);
+static void hashleaves(struct sotpet_workset *ws, const uint8_t *base, unsigned long b, unsigned long n);
 static void keyprep(const char *raw, int rawkeysize, KeyTableType *key1, KeyTableType *key2);
 
 
@@ -31,9 +38,8 @@ void          *sotpet_init(uint16_t cpus, const char *fun, const char *pass, uin
     MEMASSERT(w->fun)
     w->decryptflag = decryptflag;
     w->cpus = cpus;
-    w->slots = cpus*2;
-    w->workset = (struct sotpet_workset *)calloc(w->slots, sizeof(struct sotpet_workset));
-    MEMASSERT(w->workset)
+    w->slots = 0;                /* addset() makes room as the blocksets come */
+    w->workset = NULL;
     w->blocksize = blocksize;
     w->currentblocknum = w->startblocknum = startblocknum;
     w->slot = 0;
@@ -48,71 +54,286 @@ void          *sotpet_init(uint16_t cpus, const char *fun, const char *pass, uin
 
     w->shkey1 = new SotpetSharedMem(++current_blockid, (void *)w->nshkey1, CAMELLIA_TABLE_BYTE_LEN);
     w->shkey2 = new SotpetSharedMem(++current_blockid, (void *)w->nshkey2, CAMELLIA_TABLE_BYTE_LEN);
+    w->nshnewkey1 = w->nshnewkey2 = NULL;
+    w->shnewkey1 = w->shnewkey2 = NULL;
 
+    cpu_dispatch_init(NULL);     /* no-op when main() did it already */
+    w->pool = new ThreadPool(cpus);
+    w->group = new PoolGroup();
+    w->parent = NULL;
+    w->cache = NULL;
+    w->cachesectors = SOTPET_CACHESECTORS;
+
+    return w;
+}
+
+
+void          *sotpet_fork(void *wk)
+{
+    struct sotpet_container *p = (struct sotpet_container *)wk;
+    struct sotpet_container *w = (struct sotpet_container *)malloc(sizeof(struct sotpet_container));
+
+    MEMASSERT(w)
+    memcpy(w, p, sizeof *w);
+    w->fun = strdup(p->fun);
+    MEMASSERT(w->fun)
+    w->slots = 0;
+    w->workset = NULL;
+    w->slot = 0;
+    w->currentblocknum = w->startblocknum;
+
+    /* the pool takes jobs from anyone, but every file waits for its own */
+    w->group = new PoolGroup();
+    w->parent = p;
+    w->cache = NULL;
     return w;
 }
 
 int            sotpet_add_blockset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr)
+{
+    return sotpet_add_blockset_leaves(wk, numblocks, blocksize, bufferptr, NULL, 0);
+}
+
+int            sotpet_add_blockset_leaves(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, uint8_t *leaves, uint32_t leafbytes)
 {
     struct sotpet_container *w = (struct sotpet_container *)wk;
-    int oldslots = w->slots, i;
+    struct sotpet_workset *ws = addset(w, numblocks, blocksize, bufferptr);
 
-    assert(blocksize==w->blocksize);
-    if(w->slot>=w->slots)
-    {
-        w->slots += w->cpus;
-        w->workset = (struct sotpet_workset *)realloc(w->workset, w->slots * sizeof(struct sotpet_workset));
-        MEMASSERT(w->workset)
-        for(i=oldslots; i<w->slots; i++)
-            memset(w->workset+oldslots, 0, (w->slots-oldslots)*sizeof(struct sotpet_workset));
-    }
-    w->workset[w->slot].numblocks = numblocks;
-    w->workset[w->slot].blocksize = w->blocksize;
-    w->workset[w->slot].bufferptr = bufferptr;
-    w->workset[w->slot].decryptflag = w->decryptflag;
-    w->workset[w->slot].startblocknum = w->currentblocknum;
-    w->workset[w->slot].key1 = (KeyTableType *)w->shkey1->getbuf();
-    w->workset[w->slot].key2 = (KeyTableType *)w->shkey2->getbuf();
+    ws->startblocknum = w->currentblocknum;
+    ws->leaves = leaves;
+    ws->leafbytes = leafbytes;
 
     w->currentblocknum+=numblocks;
+    return 0;
+}
+
+int            sotpet_add_rangeset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, const uint8_t *srcptr, uint64_t blocknum,
+                                   uint8_t *leaves, uint32_t leafbytes)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+    struct sotpet_workset *ws = addset(w, numblocks, blocksize, bufferptr);
 
-    w->slot++;
+    /* like a fileset, the sector number is given */
+    ws->startblocknum = w->startblocknum + blocknum;
+    ws->srcptr = srcptr;
+    ws->leaves = leaves;
+    ws->leafbytes = leafbytes;
     return 0;
 }
 
-int            sotpet_process(void *wk)
+int            sotpet_add_rekeyset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, uint8_t *rekeyptr, uint64_t blocknum,
+                                   uint8_t *leaves, uint32_t leafbytes)
 {
     struct sotpet_container *w = (struct sotpet_container *)wk;
-    /* pthread_attr_t *at = (pthread_attr_t *)calloc(w->slot, sizeof(pthread_attr_t)); */
-    pthread_t *t = (pthread_t *)calloc(w->slot, sizeof(pthread_t));;
-    int *rv = (int *)calloc(w->slot, sizeof(int));
-    int i,  r=0;
+    struct sotpet_workset *ws;
+
+    if(!w->shnewkey1 || !w->decryptflag)
+        return -1;
+    ws = addset(w, numblocks, blocksize, bufferptr);
+    ws->startblocknum = w->startblocknum + blocknum;
+    ws->rekeyptr = rekeyptr;
+    ws->leaves = leaves;
+    ws->leafbytes = leafbytes;
+    return 0;
+}
 
-    //fprintf(stderr, "process %d slots\n", w->slot);
+int            sotpet_add_fileset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, uint64_t blocknum,
+                                  int ifd, uint64_t inoff, int ofd, uint64_t outoff, uint32_t outbytes, uint8_t *leaves)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+    struct sotpet_workset *ws = addset(w, numblocks, blocksize, bufferptr);
+
+    /* the ranges come in any order, so the sector number is given, currentblocknum stays */
+    ws->startblocknum = w->startblocknum + blocknum;
+    ws->leaves = leaves;
+    ws->leafbytes = outbytes;
+    ws->fileio = 1;
+    ws->ifd = ifd;
+    ws->inoff = inoff;
+    ws->ofd = ofd;
+    ws->outoff = outoff;
+    ws->outbytes = outbytes;
+    return 0;
+}
 
-    /* MEMASSERT(at) */
-    MEMASSERT(t)
-    MEMASSERT(rv)
+int            sotpet_submit(void *wk)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+    int i;
+
+    //fprintf(stderr, "process %d slots\n", w->slot);
 
     for(i=0; i<w->slot; i++)
     {
-        /* r |= pthread_attr_init(&at[i]); */
-        /* r |= pthread_create(&t[i], &at[i], myprocess, (void **)&w->workset[i]); */
-
         //fprintf(stderr, "\tslot=%d n=%d bsz=%d\n", i, w->workset[i].numblocks, w->workset[i].blocksize);
 
-        r |= pthread_create(&t[i], NULL, myprocess, (void *)&w->workset[i]);
+        w->pool->submit(myprocess, (void *)&w->workset[i], w->group);
     }
-    for(i=0; i<w->slot; i++)
+    return 0;
+}
+
+int            sotpet_wait(void *wk)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+    int i, err=0;
+
+    w->group->wait();
+    for(i=0; i<w->slot && !err; i++)
+        err = w->workset[i].err;
+    return err;
+}
+
+int            sotpet_process(void *wk)
+{
+    sotpet_submit(wk);
+    return sotpet_wait(wk);
+}
+
+int            sotpet_rekey(void *wk, const char *pass, uint16_t keysize)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+
+    if(w->parent || w->shnewkey1)
+        return -1;
+    w->nshnewkey1 = (KeyTableType *)malloc(CAMELLIA_TABLE_BYTE_LEN);
+    w->nshnewkey2 = (KeyTableType *)malloc(CAMELLIA_TABLE_BYTE_LEN);
+    MEMASSERT(w->nshnewkey1 && w->nshnewkey2)
+    memset(w->nshnewkey1, 0, CAMELLIA_TABLE_BYTE_LEN);
+    memset(w->nshnewkey2, 0, CAMELLIA_TABLE_BYTE_LEN);
+
+    keyprep(pass, keysize, w->nshnewkey1, w->nshnewkey2);
+
+    w->shnewkey1 = new SotpetSharedMem(++current_blockid, (void *)w->nshnewkey1, CAMELLIA_TABLE_BYTE_LEN);
+    w->shnewkey2 = new SotpetSharedMem(++current_blockid, (void *)w->nshnewkey2, CAMELLIA_TABLE_BYTE_LEN);
+    return 0;
+}
+
+int            sotpet_cache(void *wk, uint32_t sectors)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+
+    delete w->cache;
+    w->cache = NULL;
+    w->cachesectors = sectors;
+    return 0;
+}
+
+
+/* the part of sector b within [offset, end) into buf */
+
+static void readat_copy(uint64_t bs, uint64_t offset, uint64_t end, uint8_t *buf, uint64_t b, const uint8_t *plain)
+{
+    uint64_t from = b*bs>offset ? b*bs : offset,
+             to = (b+1)*bs<end ? (b+1)*bs : end;
+
+    memcpy(buf + (from-offset), plain + (from-b*bs), to-from);
+}
+
+
+/*
+ * The sectors wholly within the range are decrypted right where they go in
+ * buf, only the one or two at the ends go through edge.  The jobs are
+ * filesets without output, cpus*4 of them at a time; what comes out of
+ * them goes into the cache after.
+ */
+
+int64_t        sotpet_read_at(void *wk, int fd, uint64_t offset, uint64_t len, uint8_t *buf)
+{
+    struct sotpet_container *w = (struct sotpet_container *)wk;
+    struct stat st;
+    const uint8_t *p;
+    uint8_t *edge, *dst, **jp;
+    uint64_t bs = w->blocksize, nsect, end, b, b1, *jb;
+    uint32_t n, chunk, *jn;
+    int i, k, njobs, maxjobs = w->cpus*4, err = 0;
+
+    if(!w->decryptflag || w->slot)
     {
-        /* r |= pthread_join(t[i], (void **)&rv[i]); */
-        r |= pthread_join(t[i], NULL);
-        /* r |= pthread_attr_destroy(&at[i]); */
+        errno = EINVAL;
+        return -1;
     }
-    //fprintf(stderr, "process r=%d\n", r);
-    return r;
+    if(fstat(fd, &st))
+        return -1;
+    /* another file, or this one changed: nothing in the cache is of use */
+    if(w->cache && (st.st_dev!=w->cachefile.st_dev || st.st_ino!=w->cachefile.st_ino || st.st_size!=w->cachefile.st_size ||
+                    st.st_mtim.tv_sec!=w->cachefile.st_mtim.tv_sec || st.st_mtim.tv_nsec!=w->cachefile.st_mtim.tv_nsec))
+    {
+        delete w->cache;
+        w->cache = NULL;
+    }
+    w->cachefile = st;
+    nsect = st.st_size/bs;
+    if(!len || offset>=nsect*bs)
+        return 0;
+    if(len>nsect*bs-offset)
+        len = nsect*bs-offset;
+    end = offset+len;
+    b1 = (end+bs-1)/bs;
+
+    if(!w->cache)
+        w->cache = new SectorCache(bs, w->cachesectors);
+    edge = (uint8_t *)malloc(2*bs);
+    jb = (uint64_t *)malloc(maxjobs*sizeof(uint64_t));
+    jn = (uint32_t *)malloc(maxjobs*sizeof(uint32_t));
+    jp = (uint8_t **)malloc(maxjobs*sizeof(uint8_t *));
+    MEMASSERT(edge && jb && jn && jp)
+    /* every worker gets some of it, but not less than a sector and not more than a chunk */
+    chunk = (b1-offset/bs+w->cpus-1)/w->cpus;
+    chunk = chunk<1 ? 1 : chunk>READAT_CHUNK ? READAT_CHUNK : chunk;
+
+    for(b=offset/bs, njobs=0; b<b1 || njobs; )
+    {
+        if(b<b1 && (p = w->cache->get(b)))
+        {
+            readat_copy(bs, offset, end, buf, b, p);
+            b++;
+            continue;
+        }
+        if(b<b1)
+        {
+            n = 1;
+            if(b*bs<offset || (b+1)*bs>end)
+                dst = edge + (b*bs<offset ? 0 : bs);
+            else
+                for(dst = buf + (b*bs-offset); n<chunk && (b+n+1)*bs<=end && !w->cache->has(b+n); n++)
+                    ;
+            sotpet_add_fileset(w, n, bs, dst, b, fd, b*bs, -1, 0, 0, NULL);
+            jb[njobs] = b;
+            jn[njobs] = n;
+            jp[njobs++] = dst;
+            b += n;
+            if(njobs<maxjobs && b<b1)
+                continue;
+        }
+
+        err = sotpet_process(w);
+        sotpet_release(w);
+        if(err)
+            break;
+        for(i=0; i<njobs; i++)
+            for(k=0; k<(int)jn[i]; k++)
+            {
+                w->cache->put(jb[i]+k, jp[i]+k*bs);
+                if(jp[i]==edge || jp[i]==edge+bs)
+                    readat_copy(bs, offset, end, buf, jb[i], jp[i]);
+            }
+        njobs = 0;
+    }
+
+    memset(edge, 0, 2*bs);
+    free(edge);
+    free(jb);
+    free(jn);
+    free(jp);
+    if(err)
+    {
+        errno = err;
+        return -1;
+    }
+    return len;
 }
 
+
 void           sotpet_release(void *wk)
 {
     struct sotpet_container *w = (struct sotpet_container *)wk;
@@ -130,68 +351,213 @@ int            sotpet_exit(void *wk)
     struct sotpet_container *w = (struct sotpet_container *)wk;
 
     /* sotpet_reset(wk); */
+    delete w->group;
+    delete w->cache;
     free((void *)w->fun);
     free((void *)w->workset);
+    if(w->parent)
+    {
+        free((void *)w);
+        return 0;
+    }
+    delete w->pool;
     free((void *)w->nshkey1);
     free((void *)w->nshkey2);
     delete w->shkey1;
     delete w->shkey2;
+    free((void *)w->nshnewkey1);
+    free((void *)w->nshnewkey2);
+    delete w->shnewkey1;
+    delete w->shnewkey2;
     free((void *)w);
     return 0;
 }
 
 
+/* the next free workset, with everything but the block numbers */
+
+static struct sotpet_workset *addset(struct sotpet_container *w, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr)
+{
+    int oldslots = w->slots;
+
+    assert(blocksize==w->blocksize);
+    if(w->slot>=w->slots)
+    {
+        w->slots += w->cpus;
+        w->workset = (struct sotpet_workset *)realloc(w->workset, w->slots * sizeof(struct sotpet_workset));
+        MEMASSERT(w->workset)
+        memset(w->workset+oldslots, 0, (w->slots-oldslots)*sizeof(struct sotpet_workset));
+    }
+    w->workset[w->slot].numblocks = numblocks;
+    w->workset[w->slot].blocksize = w->blocksize;
+    w->workset[w->slot].bufferptr = bufferptr;
+    w->workset[w->slot].decryptflag = w->decryptflag;
+    w->workset[w->slot].key1 = (KeyTableType *)w->shkey1->getbuf();
+    w->workset[w->slot].key2 = (KeyTableType *)w->shkey2->getbuf();
+    if(w->shnewkey1)
+    {
+        w->workset[w->slot].newkey1 = (KeyTableType *)w->shnewkey1->getbuf();
+        w->workset[w->slot].newkey2 = (KeyTableType *)w->shnewkey2->getbuf();
+    }
+
+    return &w->workset[w->slot++];
+}
+
+
 /* ************************************************************************ */
 /* ************************************************************************ */
 /* ************************************************************************ */
 
 
-static void *myprocess(void *data)
+/* sectors [b0, b0+nb) from src into dst, with leaves when the plaintext may be about to be overwritten */
+
+static void encipher(struct sotpet_workset *ws, const KeyTableType *key1, const KeyTableType *key2,
+                     const uint8_t *src, uint8_t *dst, unsigned long b0, unsigned long nb, bool leaves)
 {
-    struct sotpet_workset *ws = (struct sotpet_workset *)data;
-    unsigned long i, b;
-    OctWord pos, iv, iv2, tmp, ref;
+    unsigned long i, b, j, n;
+    OctWord pos, iv, ref;
     uint8_t *p, *p0;
+    const uint8_t *s0;
+    uint8_t cbuf[CAMELLIA_LANES_MAX*CAMELLIA_BUFSIZE];
+    uint8_t ivbuf[CAMELLIA_LANES_MAX*CAMELLIA_BUFSIZE];
 
-    for(b=0; b<ws->numblocks; b++)
+    /* CBC encryption chains inside a sector, but every sector starts from its own ESSIV,
+       so up to CAMELLIA_LANES_MAX sectors go through the cipher in lockstep, one lane each */
+    for(b=b0; b<b0+nb; b+=n)
     {
-        pos.from(b + ws->startblocknum, 0);
+        n = b0+nb-b;
+        if(n>CAMELLIA_LANES_MAX)
+            n = CAMELLIA_LANES_MAX;
 
-        camellia_encrypt( pos.u.buf, ws->key2, iv.u.buf );
+        for(j=0; j<n; j++)
+        {
+            pos.from(b + j + ws->startblocknum, 0);
+            pos.to(cbuf + j*CAMELLIA_BUFSIZE);
+        }
+        camellia_encrypt_n( cbuf, key2, ivbuf, n );
 
-        p0 = (uint8_t *)ws->bufferptr + b * ws->blocksize;
+        p0 = dst + b * ws->blocksize;
+        s0 = src + b * ws->blocksize;
+        if(leaves)
+            hashleaves(ws, src, b, n);     /* the plaintext may be about to be overwritten */
         for(i=0; i<ws->blocksize; i+=CAMELLIA_BUFSIZE)
         {
-            p = p0 + i;
-            if(!ws->decryptflag)
+            for(j=0; j<n; j++)
+                memcpy(cbuf + j*CAMELLIA_BUFSIZE, s0 + j * ws->blocksize + i, CAMELLIA_BUFSIZE);
+            OctWord::xor_n(cbuf, ivbuf, n);
+            camellia_encrypt_n( cbuf, key1, ivbuf, n );
+            for(j=0; j<n; j++)
             {
-                tmp.from(p);
-                ref=tmp;
-                tmp.op_xor(iv);
-                camellia_encrypt( tmp.u.buf, ws->key1, iv.u.buf );
+                p = p0 + j * ws->blocksize + i;
+                ref.from(s0 + j * ws->blocksize + i);
+                iv.from(ivbuf + j*CAMELLIA_BUFSIZE);
                 assert(!ref.equals(iv));
                 iv.to(p);
-
-                OctWord probe;
-                probe.from(p);
-                assert(probe.equals(iv));
             }
-            else
+        }
+    }
+}
+
+
+static void decipher(struct sotpet_workset *ws, const uint8_t *src, uint8_t *dst, unsigned long b0, unsigned long nb)
+{
+    unsigned long i, b, j, n;
+    OctWord pos, iv, tmp, ref;
+    uint8_t *p, *p0;
+    const uint8_t *s0;
+    uint8_t cbuf[CAMELLIA_LANES_MAX*CAMELLIA_BUFSIZE];
+
+    for(b=b0; b<b0+nb; b++)
+    {
+        pos.from(b + ws->startblocknum, 0);
+
+        camellia_encrypt( pos.u.buf, ws->key2, iv.u.buf );
+
+        p0 = dst + b * ws->blocksize;
+        s0 = src + b * ws->blocksize;
+
+        /* CBC decryption does not chain, so the cipher runs interleaved over up to CAMELLIA_LANES_MAX blocks */
+        for(i=0; i<ws->blocksize; i+=n*CAMELLIA_BUFSIZE)
+        {
+            p = p0 + i;
+            n = (ws->blocksize-i)/CAMELLIA_BUFSIZE;
+            if(n>CAMELLIA_LANES_MAX)
+                n = CAMELLIA_LANES_MAX;
+            memcpy(cbuf, s0 + i, n*CAMELLIA_BUFSIZE);
+            camellia_decrypt_n( cbuf, ws->key1, p, n );
+            /* every block gets the ciphertext before it, the first one the IV */
+            OctWord::xor_n(p, iv.u.buf, 1);
+            OctWord::xor_n(p + CAMELLIA_BUFSIZE, cbuf, n-1);
+#ifndef NDEBUG
+            for(j=0; j<n; j++)
             {
-                iv2.from(p);
-                ref=iv2;
-                camellia_decrypt( iv2.u.buf, ws->key1, tmp.u.buf );
-                tmp.op_xor(iv);
+                ref.from(cbuf + j*CAMELLIA_BUFSIZE);
+                tmp.from(p + j*CAMELLIA_BUFSIZE);
                 assert(!ref.equals(tmp));
-                tmp.to(p);
-                iv = iv2;
             }
+#endif
+            iv.from(cbuf + (n-1)*CAMELLIA_BUFSIZE);
         }
+        hashleaves(ws, dst, b, 1);     /* while the sector is still in the cache */
     }
+}
+
 
-    /* return (void *) ws; */
-    pthread_exit((void *) ws);
-    return NULL; /* pro forma */
+static void *myprocess(void *data)
+{
+    struct sotpet_workset *ws = (struct sotpet_workset *)data;
+    const uint8_t *src = ws->srcptr ? ws->srcptr : ws->bufferptr;
+    unsigned long b, n;
+    int64_t r;
+
+    if(ws->fileio)
+    {
+        r = preadarr(ws->ifd, ws->bufferptr, (uint64_t)ws->numblocks * ws->blocksize, ws->inoff);
+        if(r!=(int64_t)ws->numblocks * ws->blocksize)
+        {
+            ws->err = r<0 ? errno : EIO;
+            return (void *) ws;
+        }
+    }
+
+    if(!ws->decryptflag)
+        encipher(ws, ws->key1, ws->key2, src, ws->bufferptr, 0, ws->numblocks, 1);
+    else if(!ws->rekeyptr)
+        decipher(ws, src, ws->bufferptr, 0, ws->numblocks);
+    else
+        /* a lane's worth of plaintext is still in the cache when it goes back through the cipher */
+        for(b=0; b<ws->numblocks; b+=n)
+        {
+            n = ws->numblocks-b;
+            if(n>CAMELLIA_LANES_MAX)
+                n = CAMELLIA_LANES_MAX;
+            decipher(ws, src, ws->bufferptr, b, n);
+            encipher(ws, ws->newkey1, ws->newkey2, ws->bufferptr, ws->rekeyptr, b, n, 0);
+        }
+
+    if(ws->fileio && ws->ofd>=0)
+        if(pwritearr(ws->ofd, ws->rekeyptr ? ws->rekeyptr : ws->bufferptr, ws->outbytes, ws->outoff)!=(int64_t)ws->outbytes)
+            ws->err = errno;
+
+    return (void *) ws;
+}
+
+
+/* leaf digests of the sectors [b, b+n) of base as far as they are within leafbytes */
+
+static void hashleaves(struct sotpet_workset *ws, const uint8_t *base, unsigned long b, unsigned long n)
+{
+    unsigned long j, off;
+
+    if(!ws->leaves)
+        return;
+    for(j=b; j<b+n; j++)
+    {
+        off = j * ws->blocksize;
+        if(off>=ws->leafbytes)
+            break;
+        sotpet_leafhash(base + off, ws->leafbytes-off < ws->blocksize ? ws->leafbytes-off : ws->blocksize, ws->leaves + j*HASHSIZE);
+    }
 }
 
 
@@ -209,7 +575,7 @@ static void keyprep(const char *raw, int rawkeysize, KeyTableType *key1, KeyTabl
         rawkeysize = strlen(raw);
 
     whirlpool_init(&wp);
-    whirlpool_add(&wp, (const uint8_t * const) raw, rawkeysize*8);
+    whirlpool_add_bytes(&wp, (const uint8_t *) raw, rawkeysize);
     whirlpool_finalize(&wp, digest);
     /*
     fputs("KEY=", stderr);
@@ -10,10 +10,62 @@ typedef short bool;
 
 void          *sotpet_init(uint16_t cpus, const char *fun, const char *pass, uint16_t keysize, uint32_t blocksize, uint64_t startblocknum, bool decryptflag);
 
+/* another context with the keys and the workers of wk, for one more file at the same time; sotpet_exit() it before wk */
+
+void          *sotpet_fork(void *wk);
+
 int            sotpet_add_blockset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr);
 
+/* same, and the plaintext sectors within the first leafbytes get their digest into leaves[] (HASHSIZE each) */
+
+int            sotpet_add_blockset_leaves(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, uint8_t *leaves, uint32_t leafbytes);
+
+/* sectors from blocknum on, read from srcptr (NULL: in place) into bufferptr */
+
+int            sotpet_add_rangeset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, const uint8_t *srcptr, uint64_t blocknum,
+                                   uint8_t *leaves, uint32_t leafbytes);
+
+/* a range of a file at sector blocknum: the worker preads it into bufferptr, runs the cipher and pwrites outbytes of it (ofd=-1: none) */
+
+int            sotpet_add_fileset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, uint64_t blocknum,
+                                  int ifd, uint64_t inoff, int ofd, uint64_t outoff, uint32_t outbytes, uint8_t *leaves);
+
+/* decrypting, every sector is encrypted again with the keys of pass; before any blockset and not on a fork */
+
+int            sotpet_rekey(void *wk, const char *pass, uint16_t keysize);
+
+/* like a rangeset in place, bufferptr ends up with the plaintext and rekeyptr with it under the keys of sotpet_rekey() */
+
+int            sotpet_add_rekeyset(void *wk, uint32_t numblocks, uint32_t blocksize, uint8_t *bufferptr, uint8_t *rekeyptr, uint64_t blocknum,
+                                   uint8_t *leaves, uint32_t leafbytes);
+
+/*
+ * len bytes of plaintext from offset on, when decrypting: fd holds the
+ * ciphertext, sector 0 at its start.  Only the sectors that aren't in the
+ * cache are read, and they are decrypted in parallel.  The encrypted
+ * trailer and the padding come out like any data, the trailer's filesize
+ * tells where the plaintext ends.  The bytes read, short at the end of
+ * the whole sectors, or -1 with errno.  Not with blocksets on the way.
+ * The cache is for one file: another one, or a new size or mtime of this
+ * one, starts it over.
+ */
+
+int64_t        sotpet_read_at(void *wk, int fd, uint64_t offset, uint64_t len, uint8_t *buf);
+
+/* how many decrypted sectors sotpet_read_at() keeps, 0 for none; the cache starts over */
+
+int            sotpet_cache(void *wk, uint32_t sectors);
+
+/* 0, or the first errno of a fileset */
+
 int            sotpet_process(void *wk);
 
+/* sotpet_process() in two halves, the caller is free in between; a fork may have its own worksets on the way then */
+
+int            sotpet_submit(void *wk);
+
+int            sotpet_wait(void *wk);
+
 void           sotpet_release(void *wk);
 
 int            sotpet_exit(void *wk);
@@ -7,6 +7,7 @@
 #include <assert.h>
 #if !BSD
 #include <sys/random.h>
+#include "linuxfun.h"
 #else
 #include "bsdfun.h"
 #endif
@@ -15,20 +16,29 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "buftools.h"
+#include "uring.h"
 #include "sotpet.h"
 #include "whirlpool.h"
 #include "sotpet_trailer.h"
 #include "sotpet_level2.hpp"
 #include "camellia.h"
-#include "fifo.hpp"
 #include "shm.hpp"
+#include "threadpool.hpp"
+#include "sectorcache.hpp"
 #include "sotpet_private.h"
 #include "endianess.h"
 
 
 uint64_t current_blockid = 0;
+bool sotpet_vmsplice = 0;
+bool sotpet_cipherdigest = 0;
 
 
 static int32_t nblocks(int32_t fillbytes, int32_t blocksize)
@@ -37,307 +47,1536 @@ static int32_t nblocks(int32_t fillbytes, int32_t blocksize)
 }
 
 
-/* ATTENTION! This function calls perror() directly and will only return 0 if no error occured. */
+/* ring buffer slot of the read / crypt / write pipeline */
+
+struct pipeslot
+  {
+    SotpetSharedMem        *shm;
+    int32_t                 fill;
+    uint8_t                *leaves;          /* sector digests for INTEGRITY_TREE */
+    bool                    last;            /* nothing follows, the reader has hit eof */
+    bool                    iodone;          /* io_uring: its read or write has completed */
+    int32_t                 iores;
+    uint64_t                iooff;
+  };
+
+
+/* state shared by the three pipeline stages, everything below mtx is guarded by it */
+
+struct pipeline
+  {
+    bool                    encflg;
+    int                     ifi,
+                            ofi;
+    int                     slots;
+    int32_t                 bufsize;
+    uint32_t                blocksize;
+    bool                    usetrailer;
+    int                     integrity;       /* INTEGRITY_FLAT, _TREE and/or _CRC */
+    void                   *sotpet;
+
+    int                     ringsize;
+    struct pipeslot        *ring;            /* slots are brought up by pipe_slot() */
+    SotpetArena            *arena;
+    size_t                  slotsize;
+    struct uring           *rio;             /* reader only, NULL if it goes through readarr() */
+    off_t                   ibase;
+    bool                    ipipe;           /* reader only, splicearr() from a pipe */
+    uint64_t                waitns;          /* reader only, time the pipe had nothing for us */
+
+    struct whirlpool        whi;             /* reader when encrypting, writer when decrypting */
+    struct whirlpool        root;            /* cipher stage when encrypting, writer when decrypting */
+    uint32_t                crc;             /* like whi */
+    uint64_t                total;
+
+    struct whirlpool        ct;              /* writer only, sotpet_cipherdigest */
+    uint64_t                needed;          /* writer only, plaintext size from the trailer */
+    struct whirlpool        leaf;            /* writer only, a sector the workers couldn't hash */
+    uint32_t                leaffill;
+
+    /***********************************/
+
+    pthread_mutex_t         mtx;
+    pthread_cond_t          cv;
+    uint64_t                nread,           /* buffers [nwritten, nread) are in the pipe */
+                            ncrypt,          /* buffers [ncrypt, nread) still need the cipher */
+                            nwritten;
+    bool                    readerdone;
+    bool                    stop;            /* the writer is done or something went wrong */
+    int                     readerr;
+  };
+
+
+/* wake up the other stages and drop the lock */
+
+static void pipe_signal(struct pipeline *pl)
+{
+    pthread_cond_broadcast(&pl->cv);
+    pthread_mutex_unlock(&pl->mtx);
+}
+
+
+/* the hash of a trailer of this version, from what has been computed for integrity */
+
+static void trailer_hash(int integrity, int version, struct whirlpool *whi, struct whirlpool *root, uint32_t crc, uint8_t *hash)
+{
+    int mode = sotpet_version_integrity(version);
+
+    if(!(integrity & mode))
+        fprintf(stderr, "trailer version %d, but the plaintext trailer said otherwise\n", version);
+    if(mode==INTEGRITY_TREE)
+        whirlpool_finalize(root, hash);
+    else if(mode==INTEGRITY_CRC)
+        sotpet_crcdigest(crc, hash);
+    else
+        whirlpool_finalize(whi, hash);
+}
+
+
+/* append the trailer and pad up to the sector, buf holds the last fill bytes of plaintext when encrypting */
+
+static int finish(uint8_t *buf, int32_t *fill, uint32_t blocksize, bool usetrailer, int integrity,
+                  struct whirlpool *whi, struct whirlpool *root, uint32_t crc, uint64_t total, uint64_t k)
+{
+    struct encrypted_trailer etr;
+    uint32_t should;
+    int32_t r;
+
+    if(usetrailer)
+    {
+        /* ifi IS AT ITS END, WE'RE ENCRYPTING AND NOW ATTACH A TRAILER WHICH ALSO SHOULD BE ENCRYPTED */
+        /* SPACE AT THE OF THE BUFFER IS ALREADY RESERVED, SO NO NEED TO RE-ALLOCATE */
+
+        memcpy(etr.magic, sotpet_magic_enc, MAGICSIZE);
+        memcpy(etr.magic2, sotpet_magic2_enc, MAGICSIZE2);
+        etr.version = UINT16_COMPAT(sotpet_integrity_version(integrity));
+        etr.trailersize = UINT16_COMPAT(sizeof etr);
+        trailer_hash(integrity, sotpet_integrity_version(integrity), whi, root, crc, etr.hash);
+        etr.filesize = UINT64_COMPAT(total);
+        etr.ctime =        /* << this should be the creation_time in the BSD sense */
+        etr.mtime = 0;     /* we don't fill these at the moment, 0 is LE and BE the same */
+        /* TODO: hw compliance */
+        fprintf(stderr, "enc: trailer i=%lu @%d\n", (long unsigned)k, *fill);
+        memcpy(buf+*fill, &etr, sizeof etr);
+        *fill += sizeof etr;
+
+        /* if necessary, we'll occupy the extra block at the end of the buffer */
+    }
+
+    /* PAD LAST BLOCK WHEN ENCRYPTING */
+
+    if((*fill%blocksize)!=0)
+    {
+        should = nblocks(*fill,blocksize)*blocksize;
+        fprintf(stderr, "pad %d bytes\n", should-*fill);
+        r = getrandom(buf+*fill, should-*fill, 0);
+        if(r<0)
+        {
+            perror("padding");
+            return errno;
+        }
+        assert(r==(int)(should-*fill));  /* actually, we don't know what to do if we don't get enough random bytes from a source that should work eternally */
+        *fill = should;
+    }
+    return 0;
+}
+
+
+static int pipe_finish(struct pipeline *pl, struct pipeslot *s, uint64_t k)
+{
+    return finish(s->shm->getbuf(), &s->fill, pl->blocksize, pl->usetrailer, pl->integrity,
+                  &pl->whi, &pl->root, pl->crc, pl->total, k);
+}
+
+
+/* the trailer #2 that follows the ciphertext */
+
+static void plain_trailer(struct plaintext_trailer *pln, int integrity)
+{
+    memset(pln, 0, sizeof *pln);
+    memcpy(pln->magic, sotpet_magic_plain, MAGICSIZE);
+    pln->version = UINT16_COMPAT(sotpet_integrity_version(integrity));
+    pln->trailersize = UINT16_COMPAT(sizeof *pln);
+}
+
+
+/*
+ * what goes after the last sector: trailer #2, and with digest the
+ * digest of everything before in front of it, its trailersize counts
+ * both then.  A reader that doesn't know the digest finds trailer #2 at
+ * the very end all the same.  Returns the length put into buf.
+ */
+
+static int32_t plain_tail(uint8_t *buf, struct plaintext_trailer *pln, struct whirlpool *ct, bool digest)
+{
+    int32_t n = 0;
+
+    if(digest)
+    {
+        whirlpool_finalize(ct, buf);
+        n = CIPHERDIGESTSIZE;
+    }
+    pln->trailersize = UINT16_COMPAT(sizeof *pln + n);
+    memcpy(buf+n, pln, sizeof *pln);
+    return n + sizeof *pln;
+}
+
+
+/* plaintext out when decrypting (ofi=-1: only hashed), up to the size in the trailer; off is where data sits in s, -1 for the carry */
+
+static int pipe_emit(struct pipeline *pl, struct pipeslot *s, const uint8_t *data, int32_t len, int32_t off)
+{
+    uint8_t digest[HASHSIZE];
+    int32_t i, n;
+
+    if(pl->needed && (uint64_t)len > pl->needed-pl->total)
+    {
+        fprintf(stderr, "shortened by trailer info: %lu -> %lu (%ld)\n", (long unsigned)(len+pl->total), (long unsigned)pl->needed, (long)(pl->needed-pl->total));
+        len = pl->needed-pl->total;
+    }
+    if(len<=0)
+        return 0;
+
+    if(pl->integrity & INTEGRITY_FLAT)
+        whirlpool_add_bytes(&pl->whi, data, len);
+    if(pl->integrity & INTEGRITY_CRC)
+        pl->crc = sotpet_crc32c(pl->crc, data, len);
+    if(pl->integrity & INTEGRITY_TREE)
+        for(i=0; i<len; i+=n)
+        {
+            n = pl->blocksize;
+            if(!pl->leaffill && off>=0 && len-i>=n && off+i+n<=s->fill)
+            {
+                /* a whole sector, the workers have hashed it */
+                whirlpool_add_bytes(&pl->root, s->leaves + (off+i)/n*HASHSIZE, HASHSIZE);
+                continue;
+            }
+            /* the rest of the tail sector, the held back bytes or the last sector */
+            n = MIN((uint32_t)(len-i), pl->blocksize-pl->leaffill);
+            whirlpool_add_bytes(&pl->leaf, data+i, n);
+            pl->leaffill += n;
+            if(pl->leaffill==pl->blocksize)
+            {
+                whirlpool_finalize(&pl->leaf, digest);
+                whirlpool_add_bytes(&pl->root, digest, HASHSIZE);
+                whirlpool_init(&pl->leaf);
+                pl->leaffill = 0;
+            }
+        }
+
+    n = pl->ofi<0 ? len : writearr(pl->ofi, (void *)data, len);
+    if(n<len)
+    {
+        perror("write");
+        return errno ? errno : EIO;
+    }
+    pl->total += n;
+    return 0;
+}
+
+
+/* r bytes have been read into s, a short read is eof; hash and finish it, tells if it was the last */
+
+static bool pipe_got(struct pipeline *pl, struct pipeslot *s, uint64_t k, int32_t r)
+{
+    bool eofflg = r<pl->bufsize;
+
+    s->fill = r;
+    assert(s->fill<=pl->bufsize);
+    if(r>0 && pl->encflg)
+    {
+        if(pl->integrity & INTEGRITY_FLAT)
+            whirlpool_add_bytes(&pl->whi, s->shm->getbuf(), r);
+        if(pl->integrity & INTEGRITY_CRC)
+            pl->crc = sotpet_crc32c(pl->crc, s->shm->getbuf(), r);
+        pl->total += r;
+    }
+
+    /* the root of the tree is known only after the cipher stage hashed the leaves, it finishes the buffer then */
+    if(pl->encflg && eofflg && !(pl->integrity & INTEGRITY_TREE))
+    {
+        pl->readerr = pipe_finish(pl, s, k);
+        if(pl->readerr)
+            return eofflg;
+    }
+    if(pl->encflg && !(eofflg && (pl->integrity & INTEGRITY_TREE)))
+    {
+        assert((s->fill%CAMELLIA_BLOCK_SIZE)==0);
+        assert((s->fill%pl->blocksize)==0);
+    }
+    return eofflg;
+}
+
+
+/* the slot for buffer k, its memory is only taken from the arena when the reader first gets there */
+
+static struct pipeslot *pipe_slot(struct pipeline *pl, uint64_t k)
+{
+    struct pipeslot *s = &pl->ring[k % pl->ringsize];
+
+    if(!s->shm)
+    {
+        s->shm = new SotpetSharedMem(++current_blockid, pl->arena, pl->slotsize);
+        if(pl->integrity & INTEGRITY_TREE)
+        {
+            s->leaves = (uint8_t *)malloc(nblocks(pl->slotsize,pl->blocksize) * HASHSIZE);
+            MEMASSERT(s->leaves)
+        }
+    }
+    return s;
+}
+
+
+/*
+ * an io_uring for one stage, NULL means readarr()/writearr().  With fixed
+ * the whole arena is registered as buffer 0, which pins and so faults in
+ * all of it; only worth it when the ring is no bigger than the input.
+ */
+
+static struct uring *pipe_uring(struct pipeline *pl, int fd, off_t *pos, bool fixed)
+{
+    struct uring *u;
+    struct iovec iov;
+    struct stat st;
+
+    if(uring_probe(NULL)<=0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || (fcntl(fd, F_GETFL) & O_APPEND))
+        return NULL;
+    *pos = lseek(fd, 0, SEEK_CUR);
+    if(*pos<0)
+        return NULL;
+    u = (struct uring *)malloc(sizeof *u);
+    MEMASSERT(u)
+    if(uring_init(u, pl->ringsize))
+    {
+        free(u);
+        return NULL;
+    }
+    iov.iov_base = pl->arena->getbase();
+    iov.iov_len = pl->arena->getlen();
+    if(fixed && uring_register(u, &iov, 1))
+        fprintf(stderr, "io_uring: buffers not registered\n");
+    return u;
+}
+
+
+/* writer on io_uring: take the completed writes, the slots go back to the reader in order up to ksub */
+
+static int pipe_written(struct pipeline *pl, struct uring *u, uint64_t *kw, uint64_t ksub, unsigned wait)
+{
+    struct pipeslot *s;
+    uint64_t tag;
+    int64_t n;
+    int32_t r;
+    int err;
+
+    err = uring_submit(u, wait);
+    while(uring_reap(u, &tag, &r))
+    {
+        s = &pl->ring[tag % pl->ringsize];
+        s->iodone = 1;
+        if(r>=0 && r<s->fill)
+        {
+            /* short, the disk is about full, let write() tell why */
+            n = pwritearr(pl->ofi, s->shm->getbuf()+r, s->fill-r, s->iooff+r);
+            r += MAX(n, 0);
+        }
+        if(r<s->fill && !err)
+            err = r<0 ? -r : errno ? errno : EIO;
+    }
+    if(err)
+    {
+        errno = err;
+        perror("write");
+    }
+    while(*kw<ksub && pl->ring[*kw % pl->ringsize].iodone)
+        (*kw)++;
+
+    pthread_mutex_lock(&pl->mtx);
+    pl->nwritten = *kw;
+    pipe_signal(pl);
+    return err;
+}
+
+
+/*
+ * writer on vmsplice: the pipe holds the slot pages themselves, a slot goes
+ * back to the reader only after the other end has read all of it out of
+ * the pipe.  iooff is where the slot ends in the stream, woff how much has
+ * been put in.  A reader that splice()s the pages on only moves references,
+ * they are still queued downstream when they come back to us and get
+ * overwritten; that's why this is only done when asked for.
+ */
+
+static void pipe_spliced(struct pipeline *pl, uint64_t *kw, uint64_t ksub, uint64_t woff)
+{
+    int n = pipe_unread(pl->ofi);
+    uint64_t taken = n<0 ? 0 : woff-n;
+
+    while(*kw<ksub && pl->ring[*kw % pl->ringsize].iooff<=taken)
+        (*kw)++;
+
+    pthread_mutex_lock(&pl->mtx);
+    pl->nwritten = *kw;
+    pipe_signal(pl);
+}
+
+
+/* READER STAGE */
+
+static void *pipe_reader(void *data)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    struct pipeslot *s;
+    int32_t r;
+    uint64_t k;
+    bool eofflg;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&pl->mtx);
+        while(pl->nread-pl->nwritten >= (uint64_t)pl->ringsize && !pl->stop)
+            pthread_cond_wait(&pl->cv, &pl->mtx);
+        k = pl->nread;
+        if(pl->stop)
+        {
+            pthread_mutex_unlock(&pl->mtx);
+            break;
+        }
+        pthread_mutex_unlock(&pl->mtx);
+
+        s = pipe_slot(pl, k);
+        if(pl->ipipe)
+            r = splicearr(pl->ifi, s->shm->getfd(), s->shm->getbuf(), s->shm->getoff(), pl->bufsize, &pl->waitns);
+        else
+            r = readarr(pl->ifi, s->shm->getbuf(), pl->bufsize);
+        if(r<0)
+        {
+            pl->readerr = errno;
+            perror("reading");
+            break;
+        }
+        eofflg = pipe_got(pl, s, k, r);
+        if(pl->readerr)
+            break;
+
+        pthread_mutex_lock(&pl->mtx);
+        s->last = eofflg;
+        pl->nread++;
+        pipe_signal(pl);
+
+        if(eofflg)
+            break;
+    }
+
+    pthread_mutex_lock(&pl->mtx);
+    pl->readerdone = 1;
+    pipe_signal(pl);
+    return NULL;
+}
+
+
+/*
+ * READER STAGE on io_uring, for a regular file: every free slot has its
+ * read in flight at its own offset, the completions are taken in order.
+ * A read may come back short before eof, the rest of its slot is asked
+ * for again right away; only a read that gets nothing is eof, as with
+ * readarr().  nbuf is only a guess from fstat() so not too many reads go
+ * beyond eof.
+ */
+
+static void *pipe_reader_uring(void *data)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    struct uring *u = pl->rio;
+    struct pipeslot *s, *t;
+    struct stat st;
+    uint64_t k, nsub, lim, nbuf, tag, got=0;
+    int32_t r;
+    int err;
+    bool eofflg;
+
+    nbuf = fstat(pl->ifi, &st) ? 1 : (st.st_size-pl->ibase)/pl->bufsize + 1;
+    for(nsub=0; ; )
+    {
+        pthread_mutex_lock(&pl->mtx);
+        while(pl->nread-pl->nwritten >= (uint64_t)pl->ringsize && !pl->stop)
+            pthread_cond_wait(&pl->cv, &pl->mtx);
+        k = pl->nread;
+        lim = MIN(nbuf, pl->nwritten+pl->ringsize);
+        if(pl->stop)
+        {
+            pthread_mutex_unlock(&pl->mtx);
+            break;
+        }
+        pthread_mutex_unlock(&pl->mtx);
+
+        for(; nsub<lim; nsub++)
+        {
+            s = pipe_slot(pl, nsub);
+            s->iodone = 0;
+            s->iores = 0;
+            if(uring_prep(u, 0, pl->ifi, s->shm->getbuf(), pl->bufsize, pl->ibase+nsub*pl->bufsize, 0, nsub))
+                break;
+        }
+
+        s = &pl->ring[k % pl->ringsize];
+        while(!s->iodone)
+        {
+            err = uring_submit(u, 1);
+            if(err)
+            {
+                pl->readerr = errno = err;
+                perror("io_uring");
+                goto out;
+            }
+            while(uring_reap(u, &tag, &r))
+            {
+                t = &pl->ring[tag % pl->ringsize];
+                if(r<0)
+                {
+                    t->iores = r;
+                    t->iodone = 1;
+                    continue;
+                }
+                t->iores += r;
+                if(r>0 && t->iores<pl->bufsize)
+                {
+                    /* short, but that isn't eof yet */
+                    err = uring_prep(u, 0, pl->ifi, t->shm->getbuf()+t->iores, pl->bufsize-t->iores,
+                                     pl->ibase+tag*pl->bufsize+t->iores, 0, tag);
+                    if(!err)
+                        continue;
+                    t->iores = -err;
+                }
+                t->iodone = 1;
+            }
+        }
+        r = s->iores;
+        if(r<0)
+        {
+            pl->readerr = errno = -r;
+            perror("reading");
+            break;
+        }
+        got += r;
+        eofflg = pipe_got(pl, s, k, r);
+        if(pl->readerr)
+            break;
+        if(!eofflg && k+1==nbuf)
+            nbuf++;             /* it has grown */
+
+        pthread_mutex_lock(&pl->mtx);
+        s->last = eofflg;
+        pl->nread++;
+        pipe_signal(pl);
+
+        if(eofflg)
+            break;
+    }
+
+  out:
+    /* the kernel may still be reading into slots beyond eof, they must be quiet before the ring goes away */
+    while(u->inflight+u->queued && !uring_submit(u, u->inflight+u->queued))
+        while(uring_reap(u, &tag, &r))
+            ;
+    lseek(pl->ifi, pl->ibase+got, SEEK_SET);
+
+    pthread_mutex_lock(&pl->mtx);
+    pl->readerdone = 1;
+    pipe_signal(pl);
+    return NULL;
+}
+
+
+/* CRYPTO STAGE, hands up to slots buffers at once to the worker pool */
+
+static void *pipe_crypto(void *data)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    struct pipeslot *s;
+    uint64_t k, k0, k1, j;
+    uint32_t i;
+    bool tree = pl->encflg && (pl->integrity & INTEGRITY_TREE);
+    int err;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&pl->mtx);
+        while(pl->ncrypt==pl->nread && !pl->readerdone && !pl->stop)
+            pthread_cond_wait(&pl->cv, &pl->mtx);
+        if(pl->stop || pl->ncrypt==pl->nread)
+        {
+            pthread_mutex_unlock(&pl->mtx);
+            break;
+        }
+        k0 = pl->ncrypt;
+        k1 = MIN(pl->nread, k0+pl->slots);
+        pthread_mutex_unlock(&pl->mtx);
+
+        for(k=k0; k<k1; k++)
+        {
+            s = &pl->ring[k % pl->ringsize];
+            /* the trailer goes into the last buffer and it carries the root, so that one waits for the others */
+            if(tree && s->last)
+                break;
+            sotpet_add_blockset_leaves(pl->sotpet, nblocks(s->fill,pl->blocksize), pl->blocksize, s->shm->getbuf(),
+                                       (pl->integrity & INTEGRITY_TREE) ? s->leaves : NULL, s->fill);
+        }
+        if(k>k0)
+        {
+            sotpet_process(pl->sotpet);
+            sotpet_release(pl->sotpet);
+        }
+
+        if(tree)
+        {
+            for(j=k0; j<k; j++)
+            {
+                s = &pl->ring[j % pl->ringsize];
+                whirlpool_add_bytes(&pl->root, s->leaves, nblocks(s->fill,pl->blocksize)*HASHSIZE);
+            }
+            if(k<k1)
+            {
+                s = &pl->ring[k % pl->ringsize];
+                for(i=0; i<(uint32_t)s->fill; i+=pl->blocksize)
+                    sotpet_leafhash(s->shm->getbuf()+i, MIN(pl->blocksize, s->fill-i), s->leaves + i/pl->blocksize*HASHSIZE);
+                whirlpool_add_bytes(&pl->root, s->leaves, nblocks(s->fill,pl->blocksize)*HASHSIZE);
+                err = pipe_finish(pl, s, k);
+                if(err)
+                {
+                    pthread_mutex_lock(&pl->mtx);
+                    pl->readerr = err;
+                    pl->stop = 1;
+                    pipe_signal(pl);
+                    break;
+                }
+                sotpet_add_blockset(pl->sotpet, nblocks(s->fill,pl->blocksize), pl->blocksize, s->shm->getbuf());
+                sotpet_process(pl->sotpet);
+                sotpet_release(pl->sotpet);
+            }
+        }
+
+        pthread_mutex_lock(&pl->mtx);
+        pl->ncrypt = k1;
+        pipe_signal(pl);
+    }
+    return NULL;
+}
+
+
+/* the plaintext trailer at the very end tells the version without reading the stream, 0 if there's none or no way to look */
+
+static bool probe_plain(int ifi, struct plaintext_trailer *pln)
+{
+    struct stat st;
+
+    if(fstat(ifi, &st) || !S_ISREG(st.st_mode) || st.st_size<(off_t)sizeof *pln)
+        return 0;
+    if(pread(ifi, pln, sizeof *pln, st.st_size-sizeof *pln)!=(ssize_t)sizeof *pln)
+        return 0;
+    return !memcmp(pln->magic, sotpet_magic_plain, MAGICSIZE);
+}
+
+
+static int probe_version(int ifi)
+{
+    struct plaintext_trailer pln;
+
+    return probe_plain(ifi, &pln) ? UINT16_COMPAT(pln.version) : 0;
+}
+
+
+/*
+ * HASHING BACK: from a pipe the trailer version only shows at the very end,
+ * by then the plaintext has gone out.  If it went into a regular file, it
+ * can be read back from there and hashed in the one mode the trailer asks
+ * for, instead of all of them on the way.  A descriptor to read ofi from
+ * and where the plaintext starts in it, or -1.
+ */
+
+static int readback_open(int ofi, off_t *obase)
+{
+    struct stat ost, rst;
+    int fd;
+
+    if(ofi<0 || fstat(ofi, &ost) || !S_ISREG(ost.st_mode) || (fcntl(ofi, F_GETFL) & O_APPEND))
+        return -1;
+    *obase = lseek(ofi, 0, SEEK_CUR);
+    if(*obase<0)
+        return -1;
+    fd = reopen_rdonly(ofi);
+    if(fd>=0 && (fstat(fd, &rst) || rst.st_dev!=ost.st_dev || rst.st_ino!=ost.st_ino || (fcntl(fd, F_GETFL) & O_ACCMODE)==O_WRONLY))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+
+/* len bytes of plaintext from off on into whi, or sector by sector into the leaves of root */
+
+static int readback_hash(int fd, off_t off, uint64_t len, uint32_t blocksize, int mode, struct whirlpool *whi, struct whirlpool *root)
+{
+    struct whirlpool leaf;
+    uint8_t digest[HASHSIZE];
+    uint8_t *buf;
+    uint64_t done, chunk = (uint64_t)READBACK_SECTORS*blocksize;
+    int64_t r;
+    uint32_t i, n;
+    int err = 0;
+
+    buf = (uint8_t *)malloc(chunk);
+    MEMASSERT(buf)
+    for(done=0; done<len && !err; done+=r)
+    {
+        r = preadarr(fd, buf, MIN(chunk, len-done), off+done);
+        if(r<=0)
+        {
+            err = r<0 ? errno : EIO;
+            perror("reading back");
+            break;
+        }
+        if(mode==INTEGRITY_FLAT)
+            whirlpool_add_bytes(whi, buf, r);
+        else
+            for(i=0; i<r; i+=n)
+            {
+                n = MIN((uint64_t)blocksize, r-i);
+                whirlpool_init(&leaf);
+                whirlpool_add_bytes(&leaf, buf+i, n);
+                whirlpool_finalize(&leaf, digest);
+                whirlpool_add_bytes(root, digest, HASHSIZE);
+            }
+    }
+    free(buf);
+    return err;
+}
+
+
+/*
+ * Both trailers from the end of the ciphertext in ifi, which starts at ibase
+ * and ends at isize: the plaintext trailer is just read, the last sectors
+ * are decrypted for the encrypted one.  The trailer follows the plaintext
+ * directly and the padding is less than a sector, so its filesize has to
+ * be where it sits, random padding won't get this far.  etr comes out in
+ * host byte order, nsect is the number of sectors.
+ */
+
+static bool probe_tail(int ifi, off_t ibase, off_t isize, uint32_t blocksize, void *sotpet,
+                       struct plaintext_trailer *pln, struct encrypted_trailer *etr, uint64_t *nsect)
+{
+    uint64_t tailsect;
+    uint32_t tlen, ts;
+    uint8_t *tail;
+    int32_t p, r;
+    bool found = 0;
+
+    if(isize-ibase < (off_t)(sizeof *pln + blocksize))
+        return 0;
+    if(preadarr(ifi, pln, sizeof *pln, isize-sizeof *pln)!=(int64_t)sizeof *pln || memcmp(pln->magic, sotpet_magic_plain, MAGICSIZE))
+        return 0;
+    /* trailer #2 and whatever it says is in front of it, a ciphertext digest */
+    ts = UINT16_COMPAT(pln->trailersize);
+    if(ts<sizeof *pln || isize-ibase < (off_t)(ts + blocksize) || (isize-ibase-ts)%blocksize)
+        return 0;
+    *nsect = (isize-ibase-ts)/blocksize;
+
+    tailsect = MIN(*nsect, (uint64_t)nblocks(TRAILERPADDING,blocksize)+1);
+    tlen = tailsect*blocksize;
+    tail = (uint8_t *)malloc(tlen);
+    MEMASSERT(tail)
+    sotpet_add_fileset(sotpet, tailsect, blocksize, tail, *nsect-tailsect, ifi, ibase+(*nsect-tailsect)*blocksize, -1, 0, 0, NULL);
+    r = sotpet_process(sotpet);
+    sotpet_release(sotpet);
+    for(p=0; !r && (r = sotpet_findtrailer(tail+p, tlen-p))>=0; p+=r+1, r=0)
+    {
+        memcpy(etr, tail+p+r, ENCRYPTED_TRAILERSIZE);
+        if(UINT64_COMPAT(etr->filesize)==(*nsect-tailsect)*blocksize+p+r)
+        {
+            found = 1;
+            break;
+        }
+    }
+    free(tail);
+    if(!found)
+        return 0;
+
+    etr->version = UINT16_COMPAT(etr->version);
+    etr->trailersize = UINT16_COMPAT(etr->trailersize);
+    etr->filesize = UINT64_COMPAT(etr->filesize);
+    etr->ctime = UINT64_COMPAT(etr->ctime);
+    etr->mtime = UINT64_COMPAT(etr->mtime);
+    return 1;
+}
+
+
+/*
+ * SEEKABLE INPUT, decrypting a regular file into a regular file.  Both
+ * trailers are read from the end, so the plaintext size is known before
+ * anything is decrypted and nothing needs to be scanned.  The sectors
+ * are then split into ranges of numblocks which the workers pread,
+ * decrypt and pwrite on their own, ESSIV only needs the sector number.
+ * Only the hash is fed in order here, from one set of ranges while the
+ * workers are at the next one.  ofi=-1 just verifies, nothing is written.
+ *
+ * Returns -1 before anything is written if this doesn't apply, the
+ * stream pipeline takes over then and tells what is wrong.
+ */
+
+static int f2f_seekable(int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, struct trailerset *trailer, void *sotpet)
+{
+    struct stat ist, ost;
+    struct plaintext_trailer pln;
+    struct encrypted_trailer etr;
+    SotpetArena *arena;
+    SotpetSharedMem **shm;
+    uint8_t **leaves;
+    int32_t *outlen;
+    off_t ibase, obase = 0;
+    uint64_t nsect, datasect, b, filesize;
+    uint32_t n;
+    int i, j, g, nbuf, cnt[2], integrity, err=0;
+    struct whirlpool whi, root;
+    uint32_t crc = 0;
+    void *ctx[2];
+
+    if(fstat(ifi, &ist) || !S_ISREG(ist.st_mode))
+        return -1;
+    if(ofi>=0 && (fstat(ofi, &ost) || !S_ISREG(ost.st_mode) || (fcntl(ofi, F_GETFL) & O_APPEND)))
+        return -1;
+    ibase = lseek(ifi, 0, SEEK_CUR);
+    if(ofi>=0)
+        obase = lseek(ofi, 0, SEEK_CUR);
+    if(ibase<0 || obase<0 || !probe_tail(ifi, ibase, ist.st_size, blocksize, sotpet, &pln, &etr, &nsect))
+        return -1;
+
+    memcpy(&trailer->enc, &etr, ENCRYPTED_TRAILERSIZE);
+    memcpy(&trailer->pln, &pln, sizeof pln);
+    filesize = etr.filesize;
+    datasect = (filesize+blocksize-1)/blocksize;
+    fprintf(stderr, "dec: seekable, trailer @%lu, original total size=%lu\n", (long unsigned)filesize, (long unsigned)filesize);
+
+    integrity = sotpet_version_integrity(etr.version);
+    whirlpool_init(&whi);
+    whirlpool_init(&root);
+
+    /* as many ranges as workers twice, the fork has the second set, but not more than there is */
+    nbuf = MIN((uint64_t)slots, (datasect+numblocks-1)/numblocks);
+    nbuf = MAX(nbuf, 1);
+    shm = (SotpetSharedMem **)calloc(2*nbuf, sizeof(SotpetSharedMem *));
+    leaves = (uint8_t **)calloc(2*nbuf, sizeof(uint8_t *));
+    outlen = (int32_t *)calloc(2*nbuf, sizeof(int32_t));
+    MEMASSERT(shm && leaves && outlen)
+    arena = new SotpetArena(numblocks*blocksize, 2*nbuf);
+    ctx[0] = sotpet;
+    ctx[1] = sotpet_fork(sotpet);
+    for(i=0; i<2*nbuf; i++)
+    {
+        shm[i] = new SotpetSharedMem(++current_blockid, arena, numblocks*blocksize);
+        if(integrity & INTEGRITY_TREE)
+        {
+            leaves[i] = (uint8_t *)malloc(numblocks*HASHSIZE);
+            MEMASSERT(leaves[i])
+        }
+    }
+
+    for(b=0, g=0, cnt[1]=0; ; g^=1)
+    {
+        for(i=0; i<nbuf && b<datasect; i++, b+=n)
+        {
+            j = g*nbuf+i;
+            n = MIN((uint64_t)numblocks, datasect-b);
+            outlen[j] = MIN((uint64_t)n*blocksize, filesize-b*blocksize);
+            sotpet_add_fileset(ctx[g], n, blocksize, shm[j]->getbuf(), b, ifi, ibase+b*blocksize, ofi, obase+b*blocksize, outlen[j], leaves[j]);
+        }
+        cnt[g] = i;
+        sotpet_submit(ctx[g]);
+
+        /* the set before, it is done */
+        for(j=(g^1)*nbuf; j<(g^1)*nbuf+cnt[g^1]; j++)
+        {
+            if(integrity & INTEGRITY_FLAT)
+                whirlpool_add_bytes(&whi, shm[j]->getbuf(), outlen[j]);
+            if(integrity & INTEGRITY_CRC)
+                crc = sotpet_crc32c(crc, shm[j]->getbuf(), outlen[j]);
+            if(integrity & INTEGRITY_TREE)
+                whirlpool_add_bytes(&root, leaves[j], nblocks(outlen[j],blocksize)*HASHSIZE);
+        }
+
+        err = sotpet_wait(ctx[g]);
+        sotpet_release(ctx[g]);
+        if(err || !cnt[g])
+            break;
+    }
+    if(err)
+    {
+        errno = err;
+        perror("seekable");
+    }
+
+    trailer_hash(integrity, etr.version, &whi, &root, crc, trailer->hash);
+
+    /* leave both where the stream would have left them */
+    if(ofi>=0)
+        lseek(ofi, obase+filesize, SEEK_SET);
+    lseek(ifi, 0, SEEK_END);
+
+    sotpet_exit(ctx[1]);
+    for(i=0; i<2*nbuf; i++)
+    {
+        delete shm[i];
+        free(leaves[i]);
+    }
+    delete arena;
+    free(shm);
+    free(leaves);
+    free(outlen);
+    return err;
+}
+
+
+/*
+ * RANGE, [offset, offset+length) of the plaintext to ofi by sotpet_read_at(),
+ * the sectors in front of it aren't even read.  The trailer only gives
+ * the plaintext size here, its hash is over all of it and can't be
+ * checked, trailer->enc stays empty.  Without a trailer the padding of
+ * the last sector comes out too.  The window is read once and in order,
+ * so the sector cache is turned off.  sotpet_read_at() wants sector 0 at
+ * the start of ifi, so that's where ifi has to be.
+ */
+
+int            sotpet_f2f_range(int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer,
+                                uint64_t offset, uint64_t length, struct trailerset *trailer, void *sotpet)
+{
+    struct stat ist;
+    struct plaintext_trailer pln;
+    struct encrypted_trailer etr;
+    uint64_t nsect, filesize, bufsize;
+    uint8_t *buf;
+    int64_t r;
+    int err = 0;
+
+    if(trailer)
+        memset(trailer, 0, sizeof(struct trailerset));
+    if(fstat(ifi, &ist))
+        return -1;
+    if(!S_ISREG(ist.st_mode))
+    {
+        errno = ESPIPE;
+        return -1;
+    }
+    if(lseek(ifi, 0, SEEK_CUR)!=0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    filesize = ist.st_size/blocksize*blocksize;
+    if(usetrailer && probe_tail(ifi, 0, ist.st_size, blocksize, sotpet, &pln, &etr, &nsect))
+    {
+        filesize = etr.filesize;
+        if(trailer)
+            memcpy(&trailer->pln, &pln, sizeof pln);
+    }
+    else if(usetrailer)
+        fprintf(stderr, "dec: range, no trailer, the end of the last sector comes out as it is\n");
+    if(offset>filesize)
+        offset = filesize;
+    if(length>filesize-offset)
+        length = filesize-offset;
+    fprintf(stderr, "dec: range @%lu, %lu of %lu bytes\n", (long unsigned)offset, (long unsigned)length, (long unsigned)filesize);
+
+    bufsize = (uint64_t)slots*numblocks*blocksize;
+    buf = (uint8_t *)malloc(bufsize);
+    MEMASSERT(buf)
+    sotpet_cache(sotpet, 0);
+    for(; length && !err; offset+=r, length-=r)
+    {
+        r = sotpet_read_at(sotpet, ifi, offset, MIN(length, bufsize), buf);
+        if(r<=0)
+        {
+            err = r<0 ? errno : EIO;
+            perror("range");
+            break;
+        }
+        if(ofi>=0 && writearr(ofi, buf, r)<r)
+        {
+            err = errno ? errno : EIO;
+            perror("write");
+        }
+    }
+    free(buf);
+    lseek(ifi, 0, SEEK_END);
+    return err;
+}
 
-/* ifi=-1 ofi=-1 slots=1 */
 
-int            sotpet_f2f_smart(bool encflg, int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer, struct trailerset *trailer, void *sotpet)
+/*
+ * MMAP, the four argument form: ifi is mapped read-only, ofi is truncated
+ * to the size it will have and mapped writable, the workers run the cipher
+ * from one mapping straight into the other.  Nothing goes through the
+ * SotpetSharedMem buffers, only the sector with the end of the plaintext
+ * (and the trailer when encrypting) is put together on its own.
+ *
+ * A file that shrinks under the mapping kills us with SIGBUS, that's the
+ * price.  Returns -1 if this doesn't apply, ofi is untouched then.
+ */
+
+int            sotpet_f2f_mmap(bool encflg, int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer, int integrity, struct trailerset *trailer, void *sotpet)
 {
-    int32_t bufsize = numblocks*blocksize;
-    uint32_t should;
-    int i, j, err=0, maxi;
-    uint64_t total=0, needed=0;
-    struct whirlpool whi;
-    int32_t r;
-    struct encrypted_trailer etr;
+    struct stat ist, ost;
     struct plaintext_trailer pln;
-    bool eofflg = 0, shortblk;
-    //FIFO *ff = new FIFO(MAX(blocksize*2, 0x1000));
-    //FIFO *ff = new FIFO(blocksize*(numblocks+1)*slots);
-    FIFO *ff = new FIFO(TRAILERPADDING*2);
-
-    SotpetSharedMem **shm;
-    int32_t *fill;             /* [slots]                       -> last block number +1 */
-
-    //assert(blocksize>=PADDINGBLOCKSIZE);
-    //assert((blocksize%PADDINGBLOCKSIZE)==0);
-
-    // !encflg && usetrailer
-    MEMASSERT(ff)
-    ff->registermagic_add(sotpet_magic_enc, MAGICSIZE, 0);
-    ff->registermagic_add(sotpet_magic2_enc, MAGICSIZE2, OFFMAGIC2);
-    ff->registermagic_setsize(ENCRYPTED_TRAILERSIZE);
+    struct encrypted_trailer etr;
+    struct whirlpool whi, root, ct;
+    uint8_t *in, *out, *tail, **leaves;
+    uint8_t leaf[HASHSIZE];
+    uint8_t ptail[CIPHERDIGESTSIZE+sizeof(struct plaintext_trailer)];
+    uint64_t filesize, outsize, datasect, nsect, b, b0;
+    uint32_t n, tlen, crc = 0;
+    int32_t fill;
+    int i, j, nbuf, version, err=0;
 
     if(trailer)
         memset(trailer, 0, sizeof(struct trailerset));
+    if(fstat(ifi, &ist) || fstat(ofi, &ost) || !S_ISREG(ist.st_mode) || !S_ISREG(ost.st_mode) || ost.st_size || (fcntl(ofi, F_GETFL) & O_APPEND))
+        return -1;
+    if(lseek(ifi, 0, SEEK_CUR)!=0 || lseek(ofi, 0, SEEK_CUR)!=0 || (uint64_t)ist.st_size!=(size_t)ist.st_size)
+        return -1;
+
+    if(encflg)
+    {
+        filesize = ist.st_size;
+        if(!usetrailer || !integrity)
+            integrity = INTEGRITY_FLAT;
+        version = sotpet_integrity_version(integrity);
+        /* the short sector at the end grows by the trailer and its padding */
+        datasect = filesize/blocksize;
+        tlen = nblocks(filesize%blocksize + (usetrailer ? TRAILERPADDING : 0), blocksize)*blocksize;
+        outsize = datasect*blocksize + tlen + (usetrailer ? sizeof pln + (sotpet_cipherdigest ? CIPHERDIGESTSIZE : 0) : 0);
+    }
+    else
+    {
+        /* without a trailer the size isn't known in advance */
+        if(!usetrailer || !trailer || !probe_tail(ifi, 0, ist.st_size, blocksize, sotpet, &pln, &etr, &nsect))
+            return -1;
+        memcpy(&trailer->enc, &etr, ENCRYPTED_TRAILERSIZE);
+        memcpy(&trailer->pln, &pln, sizeof pln);
+        filesize = outsize = etr.filesize;
+        fprintf(stderr, "dec: mmap, original total size=%lu\n", (long unsigned)filesize);
+        version = etr.version;
+        integrity = sotpet_version_integrity(version);
+        datasect = filesize/blocksize;
+        tlen = (filesize%blocksize) ? blocksize : 0;
+    }
 
-    shm = (SotpetSharedMem **)calloc(slots,sizeof(SotpetSharedMem *));    /* sry, I don't know how to re-alloc new'ed memory */
-    MEMASSERT(shm)
-    fill = (int32_t *)calloc(slots,sizeof(int32_t));
-    MEMASSERT(fill)
-    for(i=0; i<slots; i++)
+    in = out = NULL;
+    if(ist.st_size)
+    {
+        in = (uint8_t *)mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, ifi, 0);
+        if(in==MAP_FAILED)
+            return -1;
+        madvise(in, ist.st_size, MADV_SEQUENTIAL);
+    }
+    if(outsize)
     {
-        /* all buffers have 1*sizeof(trailer) at the end when encrypting */
-        shm[i] = new SotpetSharedMem(++current_blockid, bufsize + ((encflg && usetrailer) ? blocksize : 0), true);
+        if(ftruncate(ofi, outsize) || (out = (uint8_t *)mmap(NULL, outsize, PROT_READ|PROT_WRITE, MAP_SHARED, ofi, 0))==MAP_FAILED)
+        {
+            if(ftruncate(ofi, 0)) {}
+            if(in)
+                munmap(in, ist.st_size);
+            return -1;
+        }
     }
+
     whirlpool_init(&whi);
-    /* INIT PROCEDURE END */
+    whirlpool_init(&root);
+    whirlpool_init(&ct);
 
-    /* MAIN LOOP */
-    for(;;)
+    /* twice as many ranges as workers, so a slow one doesn't hold up all others, but not more than there is */
+    nbuf = MIN((uint64_t)slots*2, (datasect+numblocks-1)/numblocks);
+    nbuf = MAX(nbuf, 1);
+    leaves = (uint8_t **)calloc(nbuf, sizeof(uint8_t *));
+    MEMASSERT(leaves)
+    for(i=0; i<nbuf && (integrity & INTEGRITY_TREE); i++)
     {
-        for(i=0; i<slots; i++)
-            fill[i]=0;
-        maxi=-1;
-        if(!eofflg)
-            for(i=0; i<slots; i++)
-            {
-                maxi=i+1;
-                r=readarr(ifi, shm[i]->getbuf(), bufsize);
-                if(r<0)
-                {
-                    err=errno;
-                    perror("reading");
-                    break;
-                }
-                fill[i]=r;
-                assert(fill[i]<=bufsize);
-                if(r>0)
-                {
-                    if(encflg)
-                    {
-                        whirlpool_add(&whi, (uint8_t *)shm[i]->getbuf(), r*8);
-                        total += r;
-                    }
-                }
-                if(!r)  /* eof */
-                {
-                    maxi--;
-                    eofflg=1;
-                    break;
-                }
-                if(r<bufsize)
-                {
-                    eofflg=1;
-                    break;
-                }
-            }
+        leaves[i] = (uint8_t *)malloc(numblocks*HASHSIZE);
+        MEMASSERT(leaves[i])
+    }
+
+    for(b=0; b<datasect; )
+    {
+        b0 = b;
+        for(i=0; i<nbuf && b<datasect; i++, b+=n)
+        {
+            n = MIN((uint64_t)numblocks, datasect-b);
+            sotpet_add_rangeset(sotpet, n, blocksize, out+b*blocksize, in+b*blocksize, b, leaves[i], n*blocksize);
+        }
+        err = sotpet_process(sotpet);
+        sotpet_release(sotpet);
         if(err)
             break;
-        if(maxi<=0 && encflg)    /* when decoding, we actually may have an empty first buffer */
-            break;
-        if(maxi==0)
+
+        for(j=0, b=b0; j<i; j++, b+=n)
         {
-            fill[0]=0;
-            maxi=1;
+            n = MIN((uint64_t)numblocks, datasect-b);
+            if(integrity & INTEGRITY_FLAT)
+                whirlpool_add_bytes(&whi, (encflg ? in : out) + b*blocksize, n*blocksize);
+            if(integrity & INTEGRITY_CRC)
+                crc = sotpet_crc32c(crc, (encflg ? in : out) + b*blocksize, n*blocksize);
+            if(integrity & INTEGRITY_TREE)
+                whirlpool_add_bytes(&root, leaves[j], n*HASHSIZE);
+            if(encflg && sotpet_cipherdigest)
+                whirlpool_add_bytes(&ct, out + b*blocksize, n*blocksize);
         }
+    }
 
-        /* END LOOP PREP */
-
+    fill = filesize%blocksize;
+    if(tlen && !err)
+    {
+        tail = (uint8_t *)malloc(tlen);
+        MEMASSERT(tail)
         if(encflg)
         {
-            i = maxi-1;
-            if(usetrailer && eofflg)
+            if(fill)
+                memcpy(tail, in+datasect*blocksize, fill);
+            if((integrity & INTEGRITY_TREE) && fill)
             {
-                /* ifi IS AT ITS END, WE'RE ENCRYPTING AND NOW ATTACH A TRAILER WHICH ALSO SHOULD BE ENCRYPTED */
-                /* SPACE AT THE OF THE BUFFER IS ALREADY RESERVED, SO NO NEED TO RE-ALLOCATE */
-
-                memcpy(etr.magic, sotpet_magic_enc, MAGICSIZE);
-                memcpy(etr.magic2, sotpet_magic2_enc, MAGICSIZE2);
-                etr.version = UINT16_COMPAT(OURVERSION);
-                etr.trailersize = UINT16_COMPAT(sizeof etr);
-                whirlpool_finalize(&whi, etr.hash);
-                etr.filesize = UINT64_COMPAT(total);
-                etr.ctime =        /* << this should be the creation_time in the BSD sense */
-                etr.mtime = 0;     /* we don't fill these at the moment, 0 is LE and BE the same */
-                /* TODO: hw compliance */
-                /* this ok because of malloc(bufsize+(encflg?TRAILERPADDING:0)) */
-                fprintf(stderr, "enc: trailer i=%d @%d\n", i, fill[i]);
-                memcpy(shm[i]->getbuf()+fill[i], &etr, sizeof etr);
-                fill[i] += sizeof etr;
-
-                /* if necessary, we'll occupy the extra block at the end of the buffer */
+                sotpet_leafhash(tail, fill, leaf);
+                whirlpool_add_bytes(&root, leaf, HASHSIZE);
             }
+            if(integrity & INTEGRITY_FLAT)
+                whirlpool_add_bytes(&whi, tail, fill);
+            if(integrity & INTEGRITY_CRC)
+                crc = sotpet_crc32c(crc, tail, fill);
+            err = finish(tail, &fill, blocksize, usetrailer, integrity, &whi, &root, crc, filesize, datasect/numblocks);
+            sotpet_add_rangeset(sotpet, fill/blocksize, blocksize, tail, NULL, datasect, NULL, 0);
+        }
+        else
+            sotpet_add_rangeset(sotpet, 1, blocksize, tail, in+datasect*blocksize, datasect, (integrity & INTEGRITY_TREE) ? leaf : NULL, fill);
+        if(!err)
+            err = sotpet_process(sotpet);
+        sotpet_release(sotpet);
+        if(!err)
+        {
+            memcpy(out+datasect*blocksize, tail, fill);
+            if(encflg && sotpet_cipherdigest)
+                whirlpool_add_bytes(&ct, tail, fill);
+            if(!encflg && (integrity & INTEGRITY_FLAT))
+                whirlpool_add_bytes(&whi, tail, fill);
+            if(!encflg && (integrity & INTEGRITY_CRC))
+                crc = sotpet_crc32c(crc, tail, fill);
+            if(!encflg && (integrity & INTEGRITY_TREE))
+                whirlpool_add_bytes(&root, leaf, HASHSIZE);
+        }
+        free(tail);
+    }
+    if(encflg && usetrailer && !err)
+    {
+        plain_trailer(&pln, integrity);
+        fill = plain_tail(ptail, &pln, &ct, sotpet_cipherdigest);
+        memcpy(out+outsize-fill, ptail, fill);
+    }
+
+    if(err)
+    {
+        errno = err;
+        perror("mmap");
+    }
+    else if(!encflg)
+        trailer_hash(integrity, version, &whi, &root, crc, trailer->hash);
+
+    for(i=0; i<nbuf; i++)
+        free(leaves[i]);
+    free(leaves);
+    if(out)
+        munmap(out, outsize);
+    if(in)
+        munmap(in, ist.st_size);
+    lseek(ofi, outsize, SEEK_SET);
+    lseek(ifi, 0, SEEK_END);
+    return err;
+}
+
+
+/* ATTENTION! This function calls perror() directly and will only return 0 if no error occured. */
+
+/* ifi=-1 ofi=-1 slots=1 */
+
+int            sotpet_f2f_smart(bool encflg, int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer, int integrity, struct trailerset *trailer, void *sotpet)
+{
+    struct pipeline pl;
+    struct pipeslot *s;
+    pthread_t reader, crypto;
+    int i, j, err=0;
+    uint64_t k, ksub=0, kw=0;
+    struct uring *wio = NULL;
+    off_t woff = 0;
+    bool vms = 0;
+    struct timespec ts, t0;
+    struct stat st;
+    off_t ipos;
+    uint64_t rest;
+    bool sized;
+    int32_t r, m;
+    uint8_t leaf[HASHSIZE];
+    uint8_t ptail[CIPHERDIGESTSIZE+sizeof(struct plaintext_trailer)];
+    uint8_t *buf, *tp;
+    uint8_t carry[2*(ENCRYPTED_TRAILERSIZE-1)];     /* held back bytes, then the start of the next buffer */
+    int32_t carrylen = 0;
+    struct encrypted_trailer etr;
+    struct plaintext_trailer pln;
+    bool eofflg = 0;
+    int rfd = -1;
+    off_t obase = 0;
+
+    //assert(blocksize>=PADDINGBLOCKSIZE);
+    //assert((blocksize%PADDINGBLOCKSIZE)==0);
+
+    if(trailer)
+        memset(trailer, 0, sizeof(struct trailerset));
 
-            r = fill[i];
-            shortblk = (r%blocksize)!=0;
+    if(!encflg && usetrailer && trailer)
+    {
+        r = f2f_seekable(ifi, ofi, slots, numblocks, blocksize, trailer, sotpet);
+        if(r>=0)
+            return r;
+    }
+
+    memset(&pl, 0, sizeof pl);
+    pl.encflg = encflg;
+    pl.ifi = ifi;
+    pl.ofi = ofi;
+    pl.slots = slots;
+    pl.bufsize = numblocks*blocksize;
+    pl.blocksize = blocksize;
+    pl.usetrailer = usetrailer;
+    pl.sotpet = sotpet;
+
+    /*
+     * when decrypting, compute what the trailer will ask for.  If that can't
+     * be told in advance, only the CRC32C goes along, and the output is hashed
+     * back once the trailer is there; without that all of them it is.
+     */
+    if(!usetrailer)
+        integrity = INTEGRITY_FLAT;
+    else if(!integrity && encflg)
+        integrity = INTEGRITY_FLAT;
+    else if(!encflg)
+    {
+        r = probe_version(ifi);
+        if(r>0)
+            integrity = sotpet_version_integrity(r);
+        else if((rfd = readback_open(ofi, &obase))>=0)
+            integrity = INTEGRITY_CRC;
+        else
+            integrity = INTEGRITY_FLAT|INTEGRITY_TREE|INTEGRITY_CRC;
+    }
+    pl.integrity = integrity;
+
+    /* one batch being read, one being encrypted and one being written */
+    pl.ringsize = slots*3;
+
+    /* a regular file tells how much is coming: no more and no bigger buffers than that needs */
+    sized = !fstat(ifi, &st) && S_ISREG(st.st_mode) && (ipos = lseek(ifi, 0, SEEK_CUR))>=0;
+    if(sized)
+    {
+        rest = st.st_size>ipos ? st.st_size-ipos : 0;
+        if(rest<(uint64_t)pl.bufsize)
+            pl.bufsize = nblocks(rest+1,blocksize)*blocksize;
+        pl.ringsize = MIN((uint64_t)pl.ringsize, rest/pl.bufsize+1);
+    }
+
+    pl.ring = (struct pipeslot *)calloc(pl.ringsize, sizeof(struct pipeslot));
+    MEMASSERT(pl.ring)
+    /* all buffers have room for the trailer and its padding at the end when encrypting */
+    pl.slotsize = pl.bufsize + ((encflg && usetrailer) ? nblocks(TRAILERPADDING,blocksize)*blocksize : 0);
+    pl.arena = new SotpetArena(pl.slotsize, pl.ringsize);
+    whirlpool_init(&pl.whi);
+    whirlpool_init(&pl.root);
+    whirlpool_init(&pl.leaf);
+    whirlpool_init(&pl.ct);
+    pthread_mutex_init(&pl.mtx, NULL);
+    pthread_cond_init(&pl.cv, NULL);
+
+    /* regular files get several reads and writes in flight at once */
+    pl.rio = pipe_uring(&pl, ifi, &pl.ibase, sized);
+    if(encflg)
+        wio = pipe_uring(&pl, ofi, &woff, sized);
 
-            /* PAD LAST BLOCK WHEN ENCRYPTING */
+    /* a pipe that holds a whole buffer lets the reader take it in one go */
+    if(!pl.rio)
+        pl.ipipe = pipe_enlarge(ifi, pl.bufsize)>0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /* a pipe takes the encrypted slots by reference, and the more it holds the longer they can stay */
+    if(encflg && !wio && sotpet_vmsplice)
+        vms = pipe_enlarge(ofi, 2*pl.slotsize)>0;
+
+    r = pthread_create(&reader, NULL, pl.rio ? pipe_reader_uring : pipe_reader, (void *)&pl);
+    if(!r)
+    {
+        r = pthread_create(&crypto, NULL, pipe_crypto, (void *)&pl);
+        if(r)
+        {
+            pthread_mutex_lock(&pl.mtx);
+            pl.stop = 1;
+            pipe_signal(&pl);
+            pthread_join(reader, NULL);
+        }
+    }
+    if(r)
+    {
+        errno = err = r;
+        perror("pthread_create");
+        goto b2;
+    }
+    /* INIT PROCEDURE END */
 
-            if(shortblk && eofflg)
+    /* MAIN LOOP, THE WRITER STAGE */
+    for(k=0; ; k++)
+    {
+        pthread_mutex_lock(&pl.mtx);
+        while(k>=pl.ncrypt && !(pl.readerdone && pl.ncrypt==pl.nread) && !pl.stop && !err)
+        {
+            if(wio && wio->inflight)
+            {
+                /* the reader may be waiting for those slots */
+                pthread_mutex_unlock(&pl.mtx);
+                err = pipe_written(&pl, wio, &kw, ksub, 1);
+                pthread_mutex_lock(&pl.mtx);
+            }
+            else if(vms && kw<ksub)
             {
-                should = nblocks(r,blocksize)*blocksize;
-                fprintf(stderr, "pad %d bytes\n", should-r);
-                assert(should<=bufsize+(encflg ? blocksize : 0));
-                if(should>0)
+                /* nothing tells when the other end reads, look again every ms */
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_nsec += 1000000;
+                if(ts.tv_nsec>=1000000000)
                 {
-                    r = getrandom(shm[i]->getbuf()+fill[i], should-fill[i], 0);
-                    if(r<0)
-                    {
-                        err=errno;
-                        perror("padding");
-                    }
-                    assert(r==(int)(should-fill[i]));  /* actually, we don't know what to do if we don't get enough random bytes from a source that should work eternally */
-                    fill[i] = should;
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000;
                 }
+                pthread_cond_timedwait(&pl.cv, &pl.mtx, &ts);
+                pthread_mutex_unlock(&pl.mtx);
+                pipe_spliced(&pl, &kw, ksub, woff);
+                pthread_mutex_lock(&pl.mtx);
             }
             else
-                assert(!shortblk);
+                pthread_cond_wait(&pl.cv, &pl.mtx);
         }
-        if(err)
+        if(k>=pl.ncrypt || err)
+        {
+            /* the reader is done and everything has been written, or the cipher stage gave up */
+            pthread_mutex_unlock(&pl.mtx);
             break;
+        }
+        pthread_mutex_unlock(&pl.mtx);
 
-        for(i=0; i<maxi; i++)
+        s = &pl.ring[k % pl.ringsize];
+        buf = s->shm->getbuf();
+        /* before the write, io_uring and vmsplice may give s back to the reader as soon as it's done */
+        if(s->last)
+            eofflg = 1;
+        if(encflg && sotpet_cipherdigest)
+            whirlpool_add_bytes(&pl.ct, buf, s->fill);
+
+        if(wio)
+        {
+            s->iodone = 0;
+            s->iooff = woff;
+            err = uring_prep(wio, 1, ofi, buf, s->fill, woff, 0, k);
+            woff += s->fill;
+            ksub = k+1;
+            if(err)
+            {
+                errno = err;
+                perror("io_uring");
+            }
+            else
+                err = pipe_written(&pl, wio, &kw, ksub, 0);
+        }
+        else if(vms)
         {
-            if(encflg)
+            r = vmsplicearr(ofi, buf, s->fill);
+            if(r<s->fill)
             {
-                assert((fill[i]%CAMELLIA_BLOCK_SIZE)==0);
-                assert((fill[i]%blocksize)==0);
+                err=errno;
+                perror("vmsplice");
             }
-            r=sotpet_add_blockset(sotpet, nblocks(fill[i],blocksize), blocksize, shm[i]->getbuf());
+            woff += s->fill;
+            s->iooff = woff;
+            ksub = k+1;
+            pipe_spliced(&pl, &kw, ksub, woff);
         }
-        if(maxi>0)
+        else if(encflg)
         {
-            r=sotpet_process(sotpet);
-            sotpet_release(sotpet);
+            r=writearr(ofi, buf, s->fill);
+            if(r<s->fill)
+            {
+                err=errno;
+                perror("write");
+            }
         }
-
-        /* detect trailer */
-        r=-1;
-        if(!encflg && usetrailer)
+        else if(usetrailer)
         {
-            for(i=0; i<maxi; i++)
+            /*
+             * detect trailer: the last ENCRYPTED_TRAILERSIZE-1 bytes of the buffer
+             * before are held back in the carry, a trailer may start in there and
+             * those bytes must not be written then.  Only a trailer starting in the
+             * carry is looked for in carry+seam, the rest of buf is scanned in place.
+             */
+            m = MIN(s->fill, ENCRYPTED_TRAILERSIZE-1);
+            memcpy(carry+carrylen, buf, m);
+            r = sotpet_findtrailer(carry, carrylen+m);
+            if(r>=carrylen)
+                r = -1;
+            if(r>=0)
+                tp = carry+r;
+            else
+            {
+                r = sotpet_findtrailer(buf, s->fill);
+                tp = r>=0 ? buf+r : NULL;
+                if(r>=0)
+                    r += carrylen;
+            }
+
+            if(tp)
             {
-                uint8_t *p = shm[i]->getbuf();
+                fprintf(stderr, "dec: trailer i=%lu @%d\n", (long unsigned)k, r-carrylen);
+                memcpy(&etr, tp, ENCRYPTED_TRAILERSIZE);
+                etr.version = UINT16_COMPAT(etr.version);
+                etr.trailersize = UINT16_COMPAT(etr.trailersize);
+                etr.filesize = UINT64_COMPAT(etr.filesize);
+                etr.ctime = UINT64_COMPAT(etr.ctime);
+                etr.mtime = UINT64_COMPAT(etr.mtime);
 
-                for(j=0; j<fill[i]; j++)
+                memcpy(&trailer->enc, &etr, ENCRYPTED_TRAILERSIZE);
+                /* oopsie, that means, we should truncate here */
+                pl.needed = etr.filesize;
+                fprintf(stderr, "original total size=%lu\n", (long unsigned)pl.needed);
+
+                /* r counts from the start of the carry */
+                err = pipe_emit(&pl, s, carry, MIN(r, carrylen), -1);
+                if(!err && r>carrylen)
+                    err = pipe_emit(&pl, s, buf, r-carrylen, 0);
+                eofflg = 1;
+            }
+            else if(s->last || s->fill<ENCRYPTED_TRAILERSIZE-1)
+            {
+                /* no trailer at all, or buf is that short it all goes into the carry */
+                if(s->last)
                 {
-                    ff->push(p[j]);      /* TODO: pushing byte-by-byte is uncool */
-                    if(ff->registermagic_detect())
-                    {
-                        r=j;
-                        break;
-                    }
+                    err = pipe_emit(&pl, s, carry, carrylen, -1);
+                    if(!err)
+                        err = pipe_emit(&pl, s, buf, s->fill, 0);
+                    carrylen = 0;
                 }
-
-                if(r>=0)
+                else
                 {
-                    fprintf(stderr, "dec: trailer i=%d @%d\n", i, r);
-                    ff->registermagic_wsget((uint8_t *)&etr, ENCRYPTED_TRAILERSIZE);
-                    /* ff->mcpy((uint8_t *)&etr, ENCRYPTED_TRAILERSIZE, r); */
-                    etr.version = UINT16_COMPAT(etr.version);
-                    etr.trailersize = UINT16_COMPAT(etr.trailersize);
-                    etr.filesize = UINT64_COMPAT(etr.filesize);
-                    etr.ctime = UINT64_COMPAT(etr.ctime);
-                    etr.mtime = UINT64_COMPAT(etr.mtime);
-
-                    memcpy(&trailer->enc, &etr, ENCRYPTED_TRAILERSIZE);
-                    /* oopsie, that means, we should truncate here */
-                    needed = etr.filesize;
-                    fprintf(stderr, "original total size=%lu\n", (long unsigned)needed);
-
-                    r -= ENCRYPTED_TRAILERSIZE;
-                    if(r<0)
-                    {
-                        //if(i>0)
-                        //    r += fill[i-1];
-                        fprintf(stderr, "WARNING: outstream has %d bytes too long\n", -r);
-                        /* the buffer before has already been written, nothing we can do */
-                        fill[i] = 0;    // pro forma
-                        maxi = i;
-                    }
-                    else
+                    j = carrylen+m-(ENCRYPTED_TRAILERSIZE-1);
+                    if(j>0)
                     {
-                        fill[i] = r;
-                        maxi = i+1;
+                        err = pipe_emit(&pl, s, carry, j, -1);
+                        memmove(carry, carry+j, ENCRYPTED_TRAILERSIZE-1);
                     }
-                    eofflg = 1;
-                    break;
+                    carrylen = carrylen+m-MAX(j, 0);
                 }
             }
-        }
-
-        for(i=0; i<maxi; i++)
-        {
-            if(fill[i]>0)
+            else
             {
-                if(!encflg && needed)
-                    if(fill[i] > needed-total)
-                    {
-                        fprintf(stderr, "shortened by trailer info: %lu -> %lu (%ld)\n", (long unsigned)(fill[i]+total), (long unsigned)needed, (long)(needed-total));
-                        fill[i] = needed-total;
-                    }
-                if(!encflg && fill[i]>0)
-                {
-                    whirlpool_add(&whi, shm[i]->getbuf(), fill[i]*8);
-                }
-                r=writearr(ofi, shm[i]->getbuf(), fill[i]);
-                if(r<fill[i])
-                {
-                    err=errno;
-                    perror("write");
-                }
-                if(!encflg)
-                {
-                    total+=r;
-                    if(needed && total>=needed)
-                        break;
-                }
+                err = pipe_emit(&pl, s, carry, carrylen, -1);
+                if(!err)
+                    err = pipe_emit(&pl, s, buf, s->fill-(ENCRYPTED_TRAILERSIZE-1), 0);
+                carrylen = ENCRYPTED_TRAILERSIZE-1;
+                memcpy(carry, buf+s->fill-carrylen, carrylen);
             }
-            if(err)
-                break;
         }
+        else
+            err = pipe_emit(&pl, s, buf, s->fill, 0);
 
-        if(err)
-            break;
-        if(maxi<=0 && !encflg)
-            break;
-        if(eofflg && encflg)
+        if(!encflg && pl.needed && pl.total>=pl.needed)
+            eofflg = 1;
+
+        /* from here on the reader may refill s */
+        pthread_mutex_lock(&pl.mtx);
+        if(!wio && !vms)
+            pl.nwritten = k+1;
+        pipe_signal(&pl);
+
+        if(err || eofflg)
             break;
 
         /* END LOOP */
     }
 
+    /* tell reader and cipher to give up on whatever is left in the ring */
+    pthread_mutex_lock(&pl.mtx);
+    pl.stop = 1;
+    pipe_signal(&pl);
+    pthread_join(crypto, NULL);
+    pthread_join(reader, NULL);
+    if(!err)
+        err = pl.readerr;
+    if(pl.ipipe)
+    {
+        /* most of the time waiting means whoever writes the pipe is the bottleneck, not us */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        fprintf(stderr, "input: waited %.3f s of %.3f s for the pipe\n", pl.waitns/1e9,
+                (ts.tv_sec-t0.tv_sec) + (ts.tv_nsec-t0.tv_nsec)/1e9);
+    }
+    while(wio && wio->inflight+wio->queued)
+    {
+        r = pipe_written(&pl, wio, &kw, ksub, wio->inflight+wio->queued);
+        if(!err)
+            err = r;
+        if(r)
+            break;
+    }
+    if(wio)
+        lseek(ofi, woff, SEEK_SET);
+
 #if DEBUG
     /* DEBUG */
     if(!encflg && usetrailer)
     {
-        r=-1;
-
         struct encrypted_trailer testbox;
-        uint8_t *testboxptr = (uint8_t*) &testbox;
 
+        memset(&testbox, 0, sizeof testbox);
         memcpy(testbox.magic, sotpet_magic_enc, MAGICSIZE);
         memcpy(testbox.magic2, sotpet_magic2_enc, MAGICSIZE2);
-        for(int testboxn=0; testboxn<ENCRYPTED_TRAILERSIZE; testboxn++)
-        {
-            ff->push(testboxptr[testboxn]);      /* TODO: pushing byte-by-byte is uncool */
-            if(ff->registermagic_detect())
-            {
-                fprintf(stderr, "dec debug detect n=%d\n", testboxn);
-                r=0;
-                break;
-            }
-        }
-        if(r<0)
-            ff->dump(0x10);
+        r = sotpet_findtrailer((uint8_t *)&testbox, ENCRYPTED_TRAILERSIZE);
+        fprintf(stderr, "dec debug detect n=%d\n", r);
     }
 #endif
 
+    if(!encflg && (integrity & INTEGRITY_TREE) && pl.leaffill)
+    {
+        /* the short sector at the end */
+        whirlpool_finalize(&pl.leaf, leaf);
+        whirlpool_add_bytes(&pl.root, leaf, HASHSIZE);
+    }
 
-    if(!encflg && usetrailer)
+    if(rfd>=0)
     {
-        whirlpool_finalize(&whi, trailer->hash);
+        m = sotpet_version_integrity(trailer->enc.version);
+        if(!err && m!=INTEGRITY_CRC && !memcmp(trailer->enc.magic, sotpet_magic_enc, MAGICSIZE))
+        {
+            fprintf(stderr, "dec: hashing back %lu bytes of the output\n", (long unsigned)pl.total);
+            err = readback_hash(rfd, obase, pl.total, blocksize, m, &pl.whi, &pl.root);
+        }
+        integrity |= m;
     }
 
+    if(!encflg && usetrailer)
+        trailer_hash(integrity, trailer->enc.version, &pl.whi, &pl.root, pl.crc, trailer->hash);
+
     /* plaintext trailer (trailer #2) */
-    if(encflg && usetrailer)
+    if(encflg && usetrailer && !err)
     {
-        memcpy(pln.magic, sotpet_magic_plain, MAGICSIZE);
-        pln.version = UINT16_COMPAT(OURVERSION);
-        pln.trailersize = UINT16_COMPAT(sizeof pln);
-        r=write(ofi, &pln, sizeof pln);
-        if(r<(int32_t)sizeof pln)
+        plain_trailer(&pln, integrity);
+        m = plain_tail(ptail, &pln, &pl.ct, sotpet_cipherdigest);
+        r=write(ofi, ptail, m);
+        if(r<m)
         {
             err=errno;
             perror("write");
@@ -345,15 +1584,267 @@ int            sotpet_f2f_smart(bool encflg, int ifi, int ofi, int slots, uint32
     }
 
     /* EXIT PROCEDURE START */
-    for(i=0; i<slots; i++)
+  b2:
+    if(rfd>=0)
+        close(rfd);
+    if(pl.rio)
+        uring_exit(pl.rio);
+    if(wio)
+        uring_exit(wio);
+    free(pl.rio);
+    free(wio);
+    pthread_cond_destroy(&pl.cv);
+    pthread_mutex_destroy(&pl.mtx);
+    for(i=0; i<pl.ringsize; i++)
     {
-        delete shm[i];
+        delete pl.ring[i].shm;
+        free(pl.ring[i].leaves);
     }
-    free(shm);
-    free(fill);
-    delete ff;
+    delete pl.arena;
+    free(pl.ring);
+    return err;
+}
+
+
+/*
+ * REKEY, the ciphertext under one password into the ciphertext under the
+ * one given to sotpet_rekey(), in a single pass.  The same worker decrypts
+ * a sector and encrypts it again, so the plaintext doesn't go anywhere.
+ * The encrypted trailer and the padding are plaintext like the rest and
+ * come along as they are, the plaintext trailer is copied: the digest in
+ * the trailer stays right, it is checked on the way as decrypting would.
+ * A ciphertext digest is made anew when the input had one, or with
+ * sotpet_cipherdigest; from a pipe that is only known at the end, so the
+ * new ciphertext gets hashed all the same.
+ *
+ * Pipes are fine: the trailer is within the last hold sectors, those are
+ * kept back from the hash until the input has ended and then searched.
+ */
+
+int            sotpet_f2f_rekey(int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer, struct trailerset *trailer, void *sotpet)
+{
+    struct encrypted_trailer etr;
+    struct plaintext_trailer pln;
+    struct whirlpool whi, root, ct;
+    SotpetArena *arena;
+    SotpetSharedMem *ibuf, *obuf;
+    uint8_t ptail[CIPHERDIGESTSIZE+sizeof(struct plaintext_trailer)];
+    uint8_t *in, *out, *base, *rp, *leaves = NULL;
+    uint8_t leaf[HASHSIZE];
+    uint64_t b = 0, hashed = 0;
+    uint32_t hold, held = 0, cap, nsect, n, j, rest, tohash, keep, crc = 0;
+    int64_t r;
+    int32_t p, q = -1;
+    int integrity, err = 0;
+    bool eofflg = 0, hashct;
+
+    if(trailer)
+        memset(trailer, 0, sizeof(struct trailerset));
+    hashct = sotpet_cipherdigest || !probe_plain(ifi, &pln) ||
+             UINT16_COMPAT(pln.trailersize)==sizeof pln+CIPHERDIGESTSIZE;
+    if(!usetrailer || !trailer)
+        integrity = 0;
+    else
+    {
+        r = probe_version(ifi);
+        integrity = r>0 ? sotpet_version_integrity(r) : INTEGRITY_FLAT|INTEGRITY_TREE|INTEGRITY_CRC;
+    }
+
+    hold = integrity ? nblocks(TRAILERPADDING,blocksize)+1 : 0;
+    cap = slots*numblocks;
+    arena = new SotpetArena((uint64_t)(hold+cap)*blocksize, 2);
+    ibuf = new SotpetSharedMem(++current_blockid, arena, (uint64_t)(hold+cap)*blocksize);
+    obuf = new SotpetSharedMem(++current_blockid, arena, (uint64_t)cap*blocksize);
+    in = ibuf->getbuf() + hold*blocksize;       /* in front of it, the plaintext held back */
+    out = obuf->getbuf();
+    if(integrity & INTEGRITY_TREE)
+    {
+        leaves = (uint8_t *)malloc((hold+cap)*HASHSIZE);
+        MEMASSERT(leaves)
+    }
+    whirlpool_init(&whi);
+    whirlpool_init(&root);
+    whirlpool_init(&ct);
+
+    while(!eofflg)
+    {
+        r = readarr(ifi, in, (uint64_t)cap*blocksize);
+        if(r<0)
+        {
+            err = errno;
+            perror("reading");
+            break;
+        }
+        eofflg = r<(int64_t)cap*blocksize;
+        nsect = r/blocksize;
+        rest = r%blocksize;
+
+        for(j=0; j<nsect && !err; j+=n)
+        {
+            n = MIN(numblocks, nsect-j);
+            err = sotpet_add_rekeyset(sotpet, n, blocksize, in+j*blocksize, out+j*blocksize, b+j,
+                                      leaves ? leaves+(hold+j)*HASHSIZE : NULL, n*blocksize);
+        }
+        if(err)
+        {
+            fprintf(stderr, "rekey: no new key\n");
+            err = EINVAL;
+            break;
+        }
+        if(nsect)
+        {
+            err = sotpet_process(sotpet);
+            sotpet_release(sotpet);
+        }
+        if(hashct)
+            whirlpool_add_bytes(&ct, out, (uint64_t)nsect*blocksize);
+        if(!err && writearr(ofi, out, (uint64_t)nsect*blocksize)<(int64_t)nsect*blocksize)
+            err = errno ? errno : EIO;
+        if(err)
+        {
+            errno = err;
+            perror("write");
+            break;
+        }
+        b += nsect;
+
+        /* hash all but the last hold sectors, those move up in front of in */
+        tohash = held+nsect>hold ? held+nsect-hold : 0;
+        keep = held+nsect-tohash;
+        base = in - held*blocksize;
+        if(integrity & INTEGRITY_FLAT)
+            whirlpool_add_bytes(&whi, base, (uint64_t)tohash*blocksize);
+        if(integrity & INTEGRITY_CRC)
+            crc = sotpet_crc32c(crc, base, (uint64_t)tohash*blocksize);
+        if(integrity & INTEGRITY_TREE)
+        {
+            whirlpool_add_bytes(&root, leaves+(hold-held)*HASHSIZE, tohash*HASHSIZE);
+            memmove(leaves+(hold-keep)*HASHSIZE, leaves+(hold-held+tohash)*HASHSIZE, keep*HASHSIZE);
+        }
+        hashed += tohash;
+        if(!eofflg)
+        {
+            memmove(in-keep*blocksize, base+tohash*blocksize, keep*blocksize);
+            held = keep;
+            continue;
+        }
+
+        /* the end, less than a sector left is the plaintext trailer, a digest of the old ciphertext in front of it goes */
+        rp = in+nsect*blocksize;
+        if(rest>=sizeof pln)
+            memcpy(&pln, rp+rest-sizeof pln, sizeof pln);
+        if(rest>=sizeof pln && !memcmp(pln.magic, sotpet_magic_plain, MAGICSIZE) && UINT16_COMPAT(pln.trailersize)==rest)
+        {
+            if(trailer)
+                memcpy(&trailer->pln, &pln, sizeof pln);
+            rest = plain_tail(ptail, &pln, &ct, hashct && (sotpet_cipherdigest || rest==sizeof pln+CIPHERDIGESTSIZE));
+            rp = ptail;
+        }
+        else if(rest)
+            fprintf(stderr, "rekey: %u bytes after the last sector, copied as they are\n", rest);
+        if(rest && writearr(ofi, rp, rest)<(int64_t)rest)
+        {
+            err = errno ? errno : EIO;
+            perror("write");
+        }
+
+        /* like probe_tail(), the trailer sits right where its filesize says */
+        base += tohash*blocksize;
+        for(p=0; integrity && (q = sotpet_findtrailer(base+p, keep*blocksize-p))>=0; p+=q+1)
+        {
+            memcpy(&etr, base+p+q, ENCRYPTED_TRAILERSIZE);
+            if(UINT64_COMPAT(etr.filesize)==hashed*blocksize+p+q)
+                break;
+        }
+        if(q>=0)
+        {
+            q += p;
+            fprintf(stderr, "rekey: trailer @%lu\n", (long unsigned)(hashed*blocksize+q));
+            if(integrity & INTEGRITY_FLAT)
+                whirlpool_add_bytes(&whi, base, q);
+            if(integrity & INTEGRITY_CRC)
+                crc = sotpet_crc32c(crc, base, q);
+            if(integrity & INTEGRITY_TREE)
+            {
+                whirlpool_add_bytes(&root, leaves+(hold-keep)*HASHSIZE, q/blocksize*HASHSIZE);
+                if(q%blocksize)
+                {
+                    sotpet_leafhash(base+q/blocksize*blocksize, q%blocksize, leaf);
+                    whirlpool_add_bytes(&root, leaf, HASHSIZE);
+                }
+            }
+            etr.version = UINT16_COMPAT(etr.version);
+            etr.trailersize = UINT16_COMPAT(etr.trailersize);
+            etr.filesize = UINT64_COMPAT(etr.filesize);
+            etr.ctime = UINT64_COMPAT(etr.ctime);
+            etr.mtime = UINT64_COMPAT(etr.mtime);
+            memcpy(&trailer->enc, &etr, ENCRYPTED_TRAILERSIZE);
+
+            trailer_hash(integrity, etr.version, &whi, &root, crc, trailer->hash);
+        }
+    }
+
+    delete ibuf;
+    delete obuf;
+    delete arena;
+    free(leaves);
     return err;
 }
 
 
+/*
+ * CIPHERTEXT DIGEST, for whoever keeps the media but not the key: the
+ * Whirlpool of everything in front of the digest, no cipher involved.
+ * Pipes are fine, the last bytes are held back until the input has
+ * ended and they turn out to be the digest and trailer #2.  The caller
+ * compares, trailer->pln.trailersize tells if there was a digest at all.
+ */
 
+int            sotpet_f2f_cipherdigest(int ifi, struct trailerset *trailer)
+{
+    struct whirlpool ct;
+    uint8_t *buf;
+    const int32_t bufsize = 1<<20,
+                  tailmax = sizeof trailer->pln + CIPHERDIGESTSIZE;
+    int64_t r;
+    int32_t keep = 0, ts;
+    int err = 0;
+
+    memset(trailer, 0, sizeof(struct trailerset));
+    buf = (uint8_t *)malloc(tailmax+bufsize);
+    MEMASSERT(buf)
+    whirlpool_init(&ct);
+
+    do
+    {
+        r = readarr(ifi, buf+keep, bufsize);
+        if(r<0)
+        {
+            err = errno;
+            perror("reading");
+            break;
+        }
+        /* hash all but the last tailmax bytes, those move to the front */
+        ts = keep+r-MIN(keep+r, tailmax);
+        whirlpool_add_bytes(&ct, buf, ts);
+        keep += r-ts;
+        memmove(buf, buf+ts, keep);
+    }
+    while(r==bufsize);
+
+    if(!err && keep>=(int32_t)sizeof trailer->pln)
+    {
+        memcpy(&trailer->pln, buf+keep-sizeof trailer->pln, sizeof trailer->pln);
+        trailer->pln.version = UINT16_COMPAT(trailer->pln.version);
+        trailer->pln.trailersize = UINT16_COMPAT(trailer->pln.trailersize);
+        if(memcmp(trailer->pln.magic, sotpet_magic_plain, MAGICSIZE))
+            memset(&trailer->pln, 0, sizeof trailer->pln);
+    }
+    if(trailer->pln.trailersize==tailmax && keep==tailmax)
+    {
+        memcpy(trailer->cthash, buf, CIPHERDIGESTSIZE);
+        whirlpool_finalize(&ct, trailer->ctdigest);
+    }
+    free(buf);
+    return err;
+}
@@ -6,8 +6,34 @@
 
 /* ifi=-1 ofi=-1 slots=1 */
 
+/* ofi=-1 when decrypting: nothing is written, the trailer is checked all the same */
 
-int            sotpet_f2f_smart(bool encflg, int ifi, int ofi, int cpus, uint32_t numblocks, uint32_t blocksize, bool usetrailer, struct trailerset *trailer, void *sotpet);
+/* integrity is what encrypting writes, 0 for the default; decrypting goes by the trailer */
 
+/* encrypting into a pipe vmsplices the buffers; 0 by default, a reader that passes the pages on with splice() gets them overwritten */
+extern bool sotpet_vmsplice;
 
+/* encrypting puts a Whirlpool of the ciphertext in front of the plaintext trailer */
+extern bool sotpet_cipherdigest;
 
+int            sotpet_f2f_smart(bool encflg, int ifi, int ofi, int cpus, uint32_t numblocks, uint32_t blocksize, bool usetrailer, int integrity, struct trailerset *trailer, void *sotpet);
+
+
+
+
+/* -1 if the files can't be mapped, nothing happened then and sotpet_f2f_smart() will do */
+
+int            sotpet_f2f_mmap(bool encflg, int ifi, int ofi, int cpus, uint32_t numblocks, uint32_t blocksize, bool usetrailer, int integrity, struct trailerset *trailer, void *sotpet);
+
+/* ciphertext in, the same under the keys of sotpet_rekey() out, the trailer is checked on the way */
+
+int            sotpet_f2f_rekey(int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer, struct trailerset *trailer, void *sotpet);
+
+/* only the plaintext bytes [offset, offset+length) of a regular file, the trailer can't be checked then; -1 with errno ESPIPE if ifi isn't one, EINVAL if it isn't at its start */
+
+int            sotpet_f2f_range(int ifi, int ofi, int slots, uint32_t numblocks, uint32_t blocksize, bool usetrailer,
+                                uint64_t offset, uint64_t length, struct trailerset *trailer, void *sotpet);
+
+/* no key needed: the Whirlpool of the ciphertext into trailer->ctdigest, the one in the file into trailer->cthash */
+
+int            sotpet_f2f_cipherdigest(int ifi, struct trailerset *trailer);
@@ -6,7 +6,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <ctype.h>
 #include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 
 #if !BSD
 #include "linuxfun.h"
@@ -18,6 +22,8 @@
 #include "sotpet_trailer.h"
 #include "sotpet_level2.hpp"
 #include "buftools.h"
+#include "cpudispatch.h"
+#include "uring.h"
 
 
 #define PASSBUF_LEN         512
@@ -27,8 +33,18 @@ const char * title = "Simple One-Trick-Pony Encryption Tool (sorbet) V%s\n";
 const char * copylight = "(C)2023 Lusers' Malfunctioning Software Association aka. KJ Wolf\n";
 const char * usage = "usage: %s  -d|-e|-h  {passwordfile}  < {infile}  > {outfile}\n"
                      "  alt: %s  -d|-e|-h  {passwordfile}    {infile}    {outfile}\n"
+                     "  alt: %s  -d|-e     {passwordfile} -b {listfile}|-\n"
+                     "  alt: %s  -r  {old passwordfile} {new passwordfile}  [{infile} {outfile} | -b {listfile}|-]\n"
+                     "  alt: %s  -v        {passwordfile}  [{infile} | -b {listfile}|-]\n"
+                     "  alt: %s  -c  [{infile}]\n"
              "  -d    decryption\n"
              "  -e    encryption\n"
+             "  -r    re-encryption with the new password, in one pass\n"
+             "  -v    verification, decrypts and checks the trailer but writes nothing\n"
+             "  -c    checks the ciphertext digest, no password needed\n"
+             "  -d --offset N --length M\n"
+             "        only those bytes of the plaintext, from a regular file; the trailer\n"
+             "        can't be checked then, the return value is 3 for unverified\n"
          /*  "  -p pw password\n"
              "  -P pf password file\n"   */
              "  -h    help\n"
@@ -37,114 +53,426 @@ const char * note1 = "\t**ATTENTION**\n"
              "Please be aware of that leaving your passwordfile undeleted / unerased / \n"
              "unwiped on a usual persistent medium might get you into trouble.\n";
 const char * help2 = "this tool accepts a pipe in and a pipe out\n";
-const char * help4 = "Environment variables:\n\tSORBET_CPUS, SORBET_NUMBLOCKS [512], SORBET_BLOCKSIZE [1024],\n\tSORBET_USE_TRAILER [1]\n";
+const char * help3 = "-b reads lines of {infile}<TAB>{outfile} and does them in one go, SORBET_JOBS\n"
+             "of them at the same time; each gets a line {status}<TAB>{infile}<TAB>{outfile}\n"
+             "on stdout, and the return value is the highest status; -v needs no {outfile}\n";
+const char * help4 = "Environment variables:\n\tSORBET_CPUS, SORBET_NUMBLOCKS [512], SORBET_BLOCKSIZE [1024],\n\tSORBET_USE_TRAILER [1], SORBET_ISA [best of scalar,sse4,avx2,avx512],\n\tSORBET_INTEGRITY [whirlpool, tree to hash in parallel or crc32c\n\t  against accidents only; -d: from the trailer],\n\tSORBET_MMAP [1, map the files of the four argument form],\n\tSORBET_URING [1, io_uring for regular files where the kernel has it],\n\tSORBET_VMSPLICE [0, 1 to vmsplice into the pipe, only if its reader\n\t  copies the data; one that splices it on gets it corrupted],\n\tSORBET_JOBS [SORBET_CPUS, files at the same time with -b],\n\tSORBET_CIPHERDIGEST [0, 1 adds a digest of the ciphertext for -c to the trailer]\n";
 
 
-int main(int argc, char *argv[])
+struct settings
+{
+    short cpus;
+    int   numblocks,
+          blocksize,
+          integrity;
+    bool  use_trailer,
+          use_mmap,
+          encflg,
+          rekey,
+          verify,
+          range;             /* --offset/--length */
+    uint64_t offset,
+          length;
+};
+
+/* -b: the workers take the lines of the list one by one */
+
+struct batchset
+{
+    const struct settings *set;
+    void            *sotpet;
+    FILE            *list;
+    pthread_mutex_t  mtx;
+    int              worst;
+};
+
+
+/* one file through a context; the return value of main() for it */
+
+static int cryptfile(const struct settings *set, int ifi, int ofi, bool named, void *sotpet, const char *name)
+{
+    struct trailerset trailer;
+    int r;
+
+    if(set->range)
+        r = sotpet_f2f_range(ifi, ofi, set->cpus, set->numblocks, set->blocksize, set->use_trailer, set->offset, set->length, &trailer, sotpet);
+    else if(set->rekey)
+        r = sotpet_f2f_rekey(ifi, ofi, set->cpus, set->numblocks, set->blocksize, set->use_trailer, &trailer, sotpet);
+    else
+        r = (named && set->use_mmap && ofi>=0) ? sotpet_f2f_mmap(set->encflg, ifi, ofi, set->cpus, set->numblocks, set->blocksize, set->use_trailer, set->integrity, &trailer, sotpet) : -1;
+    if(r<0 && set->range)
+    {
+        if(errno==ESPIPE)
+            fprintf(stderr, "%s--offset/--length: the input has to be a regular file\n", name);
+        else if(errno==EINVAL)
+            fprintf(stderr, "%s--offset/--length: the ciphertext has to start at the beginning of the input\n", name);
+        else
+            fprintf(stderr, "%s--offset/--length: %s\n", name, strerror(errno));
+        return 5;
+    }
+    if(r<0 && !set->rekey)
+        r = sotpet_f2f_smart(set->encflg, ifi, ofi, set->cpus, set->numblocks, set->blocksize, set->use_trailer, set->integrity, &trailer, sotpet);
+    if(r)
+    {
+        fprintf(stderr, "%ssotpet_f2f_%s() failed (%d)\n", name, set->range ? "range" : set->rekey ? "rekey" : "smart", r);
+        return 5;
+    }
+    if(set->range)
+    {
+        /* the hash in the trailer is over all of the plaintext */
+        fprintf(stderr, "%schecksum unverified, only a part has been decrypted\n", name);
+        return 3;
+    }
+    if(!memcmp(trailer.enc.magic, sotpet_magic_enc, MAGICSIZE) && !memcmp(trailer.enc.magic2, sotpet_magic2_enc, MAGICSIZE2))
+    {
+        fprintf(stderr, "%strailer detected\n", name);
+        if(!memcmp(trailer.enc.hash, trailer.hash, HASHSIZE))
+            fprintf(stderr, "%schecksum okay\n", name);
+        else
+        {
+            fprintf(stderr, "%schecksum DIFFERS\n", name);
+            return 1;
+        }
+    }
+    else if(!set->encflg)
+        return 2;
+    return 0;
+}
+
+
+/* -c, the ciphertext digest only, there is no key to this */
+
+static int checkcipher(const char *name)
 {
     struct trailerset trailer;
+    int ifi = STDIN_FILENO, res;
+
+    if(name && (ifi = open(name, O_RDONLY))<0)
+    {
+        perror(name);
+        return 11;
+    }
+    if(sotpet_f2f_cipherdigest(ifi, &trailer))
+    {
+        fprintf(stderr, "sotpet_f2f_cipherdigest() failed\n");
+        return 5;
+    }
+    if(trailer.pln.trailersize!=sizeof trailer.pln+CIPHERDIGESTSIZE)
+    {
+        fprintf(stderr, "no ciphertext digest\n");
+        res = 2;
+    }
+    else if(!memcmp(trailer.cthash, trailer.ctdigest, CIPHERDIGESTSIZE))
+    {
+        fprintf(stderr, "ciphertext digest okay\n");
+        res = 0;
+    }
+    else
+    {
+        fprintf(stderr, "ciphertext digest DIFFERS\n");
+        res = 1;
+    }
+    fprintf(stderr, "return value = %d\n", res);
+    return res;
+}
+
+
+/* the first line of the file, the length of it or -(return value of main()) */
+
+static int readpass(const char *name, char *passbuf)
+{
+    FILE *f;
+    int i;
+
+    f=fopen(name, "rt");
+    if(!f)
+    {
+        perror(name);
+        return -8;
+    }
+    if(!fgets(passbuf, PASSBUF_LEN, f))
+    {
+        perror(name);
+        fclose(f);
+        return -7;
+    }
+    fclose(f);
+
+    i=strlen(passbuf);
+    if(i>0 && passbuf[i-1]=='\n')
+        passbuf[--i]=0;
+    return i;
+}
+
+
+static int batchfile(struct batchset *b, const char *in, const char *out)
+{
+    char name[PATH_MAX+2];
     void *sotpet;
-    bool encflg;
-    int i,r,res=0;
+    int ifi, ofi = -1, res;
+
+    ifi = open(in, O_RDONLY);
+    if(ifi<0)
+    {
+        perror(in);
+        return 11;
+    }
+    if(!b->set->verify)
+        ofi = open(out, O_RDWR|O_EXCL|O_CREAT, 0600);
+    if(ofi<0 && !b->set->verify)
+    {
+        perror(out);
+        close(ifi);
+        return 10;
+    }
+
+    /* a context per file, so every one starts at sector 0; the keys and the pool stay */
+    snprintf(name, sizeof name, "%s: ", in);
+    sotpet = sotpet_fork(b->sotpet);
+    res = cryptfile(b->set, ifi, ofi, 1, sotpet, name);
+    sotpet_exit(sotpet);
+    close(ifi);
+    if(ofi>=0 && close(ofi) && !res)
+    {
+        perror(out);
+        res = 5;
+    }
+    return res;
+}
+
+
+static void *batchworker(void *data)
+{
+    struct batchset *b = (struct batchset *)data;
+    char *line = NULL, *out;
+    size_t len = 0;
+    ssize_t n;
+    int res;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&b->mtx);
+        n = getline(&line, &len, b->list);
+        pthread_mutex_unlock(&b->mtx);
+        if(n<0)
+            break;
+        if(n>0 && line[n-1]=='\n')
+            line[--n] = 0;
+        if(!n || *line=='#')
+            continue;
+
+        out = strchr(line, '\t');
+        if(out)
+            *out++ = 0;
+        else if(b->set->verify)
+            out = (char *)"";
+        if(out)
+            res = batchfile(b, line, out);
+        else
+        {
+            fprintf(stderr, "%s: no <TAB>{outfile}\n", line);
+            out = (char *)"";
+            res = 9;
+        }
+
+        pthread_mutex_lock(&b->mtx);
+        printf("%d\t%s\t%s\n", res, line, out);
+        fflush(stdout);
+        if(res>b->worst)
+            b->worst = res;
+        pthread_mutex_unlock(&b->mtx);
+    }
+    free(line);
+    return NULL;
+}
+
+
+static int batch(const struct settings *set, void *sotpet, const char *listname, int jobs)
+{
+    struct batchset b;
+    pthread_t *tid;
+    int i, n;
+
+    b.set = set;
+    b.sotpet = sotpet;
+    b.worst = 0;
+    b.list = strcmp(listname, "-") ? fopen(listname, "rt") : stdin;
+    if(!b.list)
+    {
+        perror(listname);
+        return 8;
+    }
+    pthread_mutex_init(&b.mtx, NULL);
+
+    if(jobs<1)
+        jobs = 1;
+    tid = (pthread_t *)malloc(jobs*sizeof(pthread_t));
+    for(n=0; tid && n<jobs; n++)
+        if(pthread_create(&tid[n], NULL, batchworker, &b))
+            break;
+    if(!n)
+        /* nobody to be had, so it is done right here */
+        batchworker(&b);
+    for(i=0; i<n; i++)
+        pthread_join(tid[i], NULL);
+
+    free(tid);
+    pthread_mutex_destroy(&b.mtx);
+    if(b.list!=stdin)
+        fclose(b.list);
+    return b.worst;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct settings set;
+    void *sotpet;
+    bool bflg;
+    int i,j,fa,res=0;
     char passbuf[PASSBUF_LEN];
-    FILE *f;
+    char newpassbuf[PASSBUF_LEN];
     char *p;
-
-    short cpus;
-    int   numblocks    = atoi(getenv_fb("SORBET_NUMBLOCKS", "512"));
-    int   blocksize    = atoi(getenv_fb("SORBET_BLOCKSIZE", "1024"));
-    bool  use_trailer  = atoi(getenv_fb("SORBET_USE_TRAILER", "1"));
+    uint64_t *num;
 
     int ifi = STDIN_FILENO;
     int ofi = STDOUT_FILENO;
 
+    set.numblocks    = atoi(getenv_fb("SORBET_NUMBLOCKS", "512"));
+    set.blocksize    = atoi(getenv_fb("SORBET_BLOCKSIZE", "1024"));
+    set.use_trailer  = atoi(getenv_fb("SORBET_USE_TRAILER", "1"));
+    set.integrity    = sotpet_integrity_mode(getenv("SORBET_INTEGRITY"));
+    set.use_mmap     = atoi(getenv_fb("SORBET_MMAP", "1"));
 
     p = getenv("SORBET_CPUS");
-    cpus = p ? (atoi(p)) : getcpus();
-    fprintf(stderr, "CPUS=%hd\n", cpus);
+    set.cpus = p ? (atoi(p)) : getcpus();
+    cpu_dispatch_init(getenv("SORBET_ISA"));
+    uring_probe(getenv_fb("SORBET_URING", "1"));
+    sotpet_vmsplice = atoi(getenv_fb("SORBET_VMSPLICE", "0"));
+    sotpet_cipherdigest = atoi(getenv_fb("SORBET_CIPHERDIGEST", "0"));
+    fprintf(stderr, "CPUS=%hd ISA=%s\n", set.cpus, cpu_dispatch_desc());
 
     fprintf(stderr, title, SOTPET_VERSION);
     fputs(copylight, stderr);
     if(argc>1 && !strcmp(argv[1],"-h"))
     {
-        printf(usage, argv[0]);
+        printf(usage, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         puts(help2);
+        puts(help3);
         puts(help4);
         fputs(note1, stdout);
         return 1;
     }
 
-    if(argc<3 && argc!=5)
+    if(argc>1 && !strcmp(argv[1],"-c"))
+        return checkcipher(argc>2 ? argv[2] : NULL);
+
+    /* --offset and --length may be anywhere after the mode, the other arguments move up */
+    set.range = 0;
+    set.offset = 0;
+    set.length = UINT64_MAX;
+    for(i=j=1; i<argc; i++)
+        if(i>1 && (!strcmp(argv[i],"--offset") || !strcmp(argv[i],"--length")))
+        {
+            num = !strcmp(argv[i],"--offset") ? &set.offset : &set.length;
+            p = argv[i];         /* not a number unless one follows */
+            if(i+1<argc && isdigit((unsigned char)*argv[i+1]))
+                *num = strtoull(argv[i+1], &p, 0);
+            if(*p)
+            {
+                fprintf(stderr, "%s: not a number after %s\n", argv[0], argv[i]);
+                return 9;
+            }
+            set.range = 1;
+            i++;
+        }
+        else
+            argv[j++] = argv[i];
+    argc = j;
+
+    /* -r has two password files, the files or the list come after those */
+    set.rekey = argc>1 && !strcmp(argv[1],"-r");
+    fa = set.rekey ? 4 : 3;
+    bflg = argc==fa+2 && !strcmp(argv[fa],"-b");
+    if(argc<fa)
     {
-        fprintf(stderr, usage, argv[0]);
+        fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         fputs(note1, stderr);
         return 1;
     }
 
-    encflg = !strcmp(argv[1],"-e");
-    if(!encflg && strcmp(argv[1],"-d"))
+    set.encflg = !strcmp(argv[1],"-e");
+    set.verify = !strcmp(argv[1],"-v");
+    if(!set.encflg && !set.rekey && !set.verify && strcmp(argv[1],"-d"))
     {
         fprintf(stderr, "%s: %s: not recognized\n", argv[0], argv[1]);
         return 9;
     }
-
-    f=fopen(argv[2], "rt");
-    if(!f)
+    if(set.range && strcmp(argv[1],"-d"))
     {
-        perror(argv[2]);
-        return 8;
+        fprintf(stderr, "%s: --offset/--length only go with -d\n", argv[0]);
+        return 9;
     }
-    if(!fgets(passbuf, PASSBUF_LEN, f))
+
+    if(set.integrity<0)
     {
-        perror(argv[2]);
-        return 7;
+        fprintf(stderr, "SORBET_INTEGRITY=%s: not recognized\n", getenv("SORBET_INTEGRITY"));
+        return 9;
     }
-    fclose(f);
+    /* it says what -e writes, everything else goes by the trailer */
+    if(!set.encflg)
+        set.integrity = 0;
 
-    if(argc>=5)
+    i = readpass(argv[2], passbuf);
+    if(i<0)
+        return -i;
+    j = set.rekey ? readpass(argv[3], newpassbuf) : 0;
+    if(j<0)
+        return -j;
+
+    if(set.verify)
+    {
+        /* nothing comes out, stdout only has the -b lines */
+        ofi = -1;
+        if(argc>=fa+1 && !bflg)
+        {
+            ifi = open(argv[fa], O_RDONLY);
+            if(ifi<0)
+            {
+                perror(argv[fa]);
+                return 11;
+            }
+        }
+    }
+    else if(argc>=fa+2 && !bflg)
     {
-        ifi = open(argv[3], O_RDONLY);
+        ifi = open(argv[fa], O_RDONLY);
         if(ifi<0)
         {
-            perror(argv[3]);
+            perror(argv[fa]);
             return 11;
         }
-        ofi = open(argv[4], O_WRONLY|O_EXCL|O_CREAT, 0600);
+        ofi = open(argv[fa+1], O_RDWR|O_EXCL|O_CREAT, 0600);
         if(ofi<0)
         {
-            perror(argv[4]);
+            perror(argv[fa+1]);
             return 10;
         }
     }
 
-    i=strlen(passbuf);
-    if(i>0 && passbuf[i-1]=='\n')
-        passbuf[--i]=0;
-    sotpet = sotpet_init(cpus, "test", passbuf, i, blocksize, 0, !encflg);
-    if(!sotpet)
+    sotpet = sotpet_init(set.cpus, "test", passbuf, i, set.blocksize, 0, !set.encflg);
+    if(!sotpet || (set.rekey && sotpet_rekey(sotpet, newpassbuf, j)))
     {
         fprintf(stderr, "sotpet_init() failed\n");
         return 6;
     }
-    r = sotpet_f2f_smart(encflg, ifi, ofi, cpus, numblocks, blocksize, use_trailer, &trailer, sotpet);
-    if(r)
+    if(bflg)
     {
-        fprintf(stderr, "sotpet_f2f_smart() failed (%d)\n", r);
-        return 5;
-    }
-    if(!memcmp(trailer.enc.magic, sotpet_magic_enc, MAGICSIZE) && !memcmp(trailer.enc.magic2, sotpet_magic2_enc, MAGICSIZE2))
-    {
-        fprintf(stderr, "trailer detected\n");
-        if(!memcmp(trailer.enc.hash, trailer.hash, HASHSIZE))
-            fprintf(stderr, "checksum okay\n");
-        else
-        {
-            fprintf(stderr, "checksum DIFFERS\n");
-            res=1;
-        }
+        p = getenv("SORBET_JOBS");
+        res = batch(&set, sotpet, argv[fa+1], p ? atoi(p) : set.cpus);
     }
     else
-        res=encflg?0:2;
+        res = cryptfile(&set, ifi, ofi, argc>=fa+2, sotpet, "");
     sotpet_exit(sotpet);
     fprintf(stderr, "return value = %d\n", res);
     return res;
@@ -4,6 +4,10 @@
 
 extern uint64_t current_blockid;
 
+#define SOTPET_CACHESECTORS 4096             /* sotpet_read_at(), until sotpet_cache() says otherwise */
+#define READAT_CHUNK        256              /* sotpet_read_at(), at most that many sectors per job */
+#define READBACK_SECTORS    1024             /* decrypting from a pipe, the output is hashed back that much at a time */
+
 
 struct sotpet_workset;
 
@@ -27,7 +31,20 @@ struct sotpet_container
                            *nshkey2;
     SotpetSharedMem        *shkey1,
                            *shkey2;
+    KeyTableType           *nshnewkey1,      // sotpet_rekey(), NULL until then
+                           *nshnewkey2;
+    SotpetSharedMem        *shnewkey1,
+                           *shnewkey2;
   //uint64_t                hashbytes;
+
+    /***********************************/
+
+    ThreadPool             *pool;            // lives from sotpet_init() to sotpet_exit()
+    PoolGroup              *group;
+    struct sotpet_container *parent;         // sotpet_fork(): keys and pool are the parent's
+    SectorCache            *cache;           // sotpet_read_at(), NULL until the first one, a fork has its own
+    uint32_t                cachesectors;
+    struct stat             cachefile;       // the file the cache holds sectors of, from fstat()
   };
 
 
@@ -39,11 +56,25 @@ struct sotpet_workset
 
     uint32_t                numblocks;
     uint32_t                blocksize;
-    uint32_t                startblocknum;
+    uint64_t                startblocknum;
     uint8_t                *bufferptr;
+    const uint8_t          *srcptr;          // NULL: in place, else the cipher reads from here
+    uint8_t                *leaves;          // NULL, or one digest per sector for TREEVERSION
+    uint32_t                leafbytes;
+    uint8_t                *rekeyptr;        // NULL, or where the plaintext goes encrypted with newkey1/2
+
+    bool                    fileio;          // the worker does pread() before and pwrite() after
+    int                     ifd,
+                            ofd;             // -1: nothing to write
+    uint64_t                inoff,
+                            outoff;
+    uint32_t                outbytes;
+    int                     err;             // errno of the file i/o
 
     /***********************************/
 
     KeyTableType           *key1,            // just references, do not free()
-                           *key2;
+                           *key2,
+                           *newkey1,
+                           *newkey2;
   };
@@ -1,8 +0,0 @@
-
-#define __STDC_FORMAT_MACROS 1
-#include <inttypes.h>
-
-#define SHM_NAME        "/SOTPET_%" PRIu64
-#define SHM_NAME_SIZE   28
-
-
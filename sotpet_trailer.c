@@ -2,9 +2,16 @@
 /* SOTPET - Simple One-Trick Pony Encryption Tool */
 
 #include <stdint.h>
+#include <string.h>
 
 #include "whirlpool.h"
 #include "sotpet_trailer.h"
+#include "cpudispatch.h"
+
+#if SOTPET_DISPATCH && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_VARIANTS 1
+#endif
 
 
 /* magic2 intentionally first */
@@ -14,3 +21,335 @@ const uint8_t sotpet_magic2_enc[] = { 0x7e, 0x27, 0xf4, 0xa2 };
 const uint8_t sotpet_magic_plain[] = { 0xfe, 0xaf, 0x0f, 0xc1, 0xd1, 0x2e, 0x93, 0x37 };
 const uint8_t sotpet_magic_enc[] = { 0xf2, 0x2f, 0x1e, 0xef, 0x59, 0xfa, 0x26, 0xa7 };
 
+
+
+/*
+ * TREEVERSION: every sector of plaintext (SORBET_BLOCKSIZE, the last one may
+ * be short) is a leaf, the root is the Whirlpool over the leaf digests in
+ * sector order.  The leaves don't depend on anything but the data and the
+ * sector size, so they can be hashed by whoever holds the sector.
+ */
+
+void sotpet_leafhash(const uint8_t *data, uint32_t len, uint8_t *digest)
+{
+    struct whirlpool wp;
+
+    whirlpool_init(&wp);
+    whirlpool_add_bytes(&wp, data, len);
+    whirlpool_finalize(&wp, digest);
+}
+
+
+/* -1 if not recognized */
+
+int  sotpet_integrity_mode(const char *name)
+{
+    if(!name || !*name)
+        return 0;
+    if(!strcmp(name, "whirlpool"))
+        return INTEGRITY_FLAT;
+    if(!strcmp(name, "tree"))
+        return INTEGRITY_TREE;
+    if(!strcmp(name, "crc32c"))
+        return INTEGRITY_CRC;
+    return -1;
+}
+
+
+/*
+ * CRCVERSION: a CRC32C (Castagnoli, as iSCSI and ext4 have it) over the
+ * plaintext, for when Whirlpool costs too much and only accidents have to
+ * be found.  SSE4.2 does 8 bytes per crc32 instruction, but one has to wait
+ * for the one before, three cycles; so a long run is cut into three streams
+ * of CRC32C_STRIDE bytes that go in lockstep and are put together after,
+ * the one in front times x^(8*CRC32C_STRIDE) modulo the polynomial.
+ *
+ * All of it is reflected (bit 31 is x^0), the crc going in and out is the
+ * usual one, inverted; 0 to start.
+ */
+
+#define CRC32C_POLY     0x82f63b78
+#define CRC32C_STRIDE   4096
+#define CRC32C_XSTRIDE  0x35d73a62      /* x^(8*CRC32C_STRIDE) mod CRC32C_POLY */
+
+static const uint32_t crc32c_table[256] =
+  {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+  };
+
+
+/* a*b mod CRC32C_POLY, a is the constant, the loop runs over its bits */
+
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1<<31, p = 0;
+
+    for(;;)
+    {
+        if(a & m)
+        {
+            p ^= b;
+            if(!(a & (m-1)))
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b>>1) ^ CRC32C_POLY : b>>1;
+    }
+    return p;
+}
+
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while(len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc>>8);
+    return crc;
+}
+
+
+#if SCAN_VARIANTS && defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t a = crc, b, c, x, y, z;
+    size_t i;
+
+    for(; len && ((uintptr_t)p & 7); len--)
+        a = _mm_crc32_u8(a, *p++);
+    for(; len>=3*CRC32C_STRIDE; len-=3*CRC32C_STRIDE, p+=3*CRC32C_STRIDE)
+    {
+        b = c = 0;
+        for(i=0; i<CRC32C_STRIDE; i+=8)
+        {
+            memcpy(&x, p+i, 8);
+            memcpy(&y, p+i+CRC32C_STRIDE, 8);
+            memcpy(&z, p+i+2*CRC32C_STRIDE, 8);
+            a = _mm_crc32_u64(a, x);
+            b = _mm_crc32_u64(b, y);
+            c = _mm_crc32_u64(c, z);
+        }
+        a = multmodp(CRC32C_XSTRIDE, multmodp(CRC32C_XSTRIDE, a) ^ b) ^ c;
+    }
+    for(; len>=8; len-=8, p+=8)
+    {
+        memcpy(&x, p, 8);
+        a = _mm_crc32_u64(a, x);
+    }
+    for(; len; len--)
+        a = _mm_crc32_u8(a, *p++);
+    return a;
+}
+
+#endif
+
+
+uint32_t sotpet_crc32c(uint32_t crc, const uint8_t *data, size_t len)
+{
+#if SCAN_VARIANTS && defined(__x86_64__)
+    if(cpu_isa>=ISA_SSE4)
+        return ~crc32c_sse42(~crc, data, len);
+#endif
+    return ~crc32c_scalar(~crc, data, len);
+}
+
+
+/* the hash field of a CRCVERSION trailer, the crc LE and zeros after */
+
+void sotpet_crcdigest(uint32_t crc, uint8_t *digest)
+{
+    memset(digest, 0, HASHSIZE);
+    digest[0] = crc;
+    digest[1] = crc>>8;
+    digest[2] = crc>>16;
+    digest[3] = crc>>24;
+}
+
+
+/* a trailer version and the integrity mode it was written with */
+
+int  sotpet_version_integrity(int version)
+{
+    switch(version)
+    {
+        case TREEVERSION: return INTEGRITY_TREE;
+        case CRCVERSION:  return INTEGRITY_CRC;
+    }
+    return INTEGRITY_FLAT;
+}
+
+
+uint16_t sotpet_integrity_version(int integrity)
+{
+    if(integrity & INTEGRITY_TREE)
+        return TREEVERSION;
+    if(integrity & INTEGRITY_CRC)
+        return CRCVERSION;
+    return OURVERSION;
+}
+
+
+/*
+ * Finding the encrypted trailer in decrypted data: the first offset where
+ * sotpet_magic_enc sits with sotpet_magic2_enc at OFFMAGIC2 and the whole
+ * trailer is within len.  The vector variants compare three bytes of the
+ * magics for a whole register of offsets at once and only the candidates
+ * get a full compare, like OctWord::xor_n they are picked from cpu_isa.
+ */
+
+static inline bool trailerat(const uint8_t *p)
+{
+    return !memcmp(p, sotpet_magic_enc, MAGICSIZE) && !memcmp(p+OFFMAGIC2, sotpet_magic2_enc, MAGICSIZE2);
+}
+
+
+/* offsets [from, n) */
+
+static int32_t findtrailer_scalar(const uint8_t *buf, int32_t from, int32_t n)
+{
+    const uint8_t *p;
+
+    for(; from<n; from = p-buf+1)
+    {
+        p = (const uint8_t *)memchr(buf+from, sotpet_magic_enc[0], n-from);
+        if(!p)
+            break;
+        if(trailerat(p))
+            return p-buf;
+    }
+    return -1;
+}
+
+
+#if SCAN_VARIANTS
+
+/* all loads stay below offset+OFFMAGIC2+MAGICSIZE2, the trailer is longer than that */
+
+__attribute__((target("sse4.1")))
+static int32_t findtrailer_sse4(const uint8_t *buf, int32_t n)
+{
+    const __m128i c0 = _mm_set1_epi8((char)sotpet_magic_enc[0]),
+                  c1 = _mm_set1_epi8((char)sotpet_magic_enc[MAGICSIZE-1]),
+                  c2 = _mm_set1_epi8((char)sotpet_magic2_enc[0]);
+    uint32_t bits;
+    int32_t i;
+
+    for(i=0; i+16<=n; i+=16)
+    {
+        bits = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf+i)), c0),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf+i+MAGICSIZE-1)), c1)),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf+i+OFFMAGIC2)), c2)));
+        for(; bits; bits&=bits-1)
+            if(trailerat(buf+i+__builtin_ctz(bits)))
+                return i+__builtin_ctz(bits);
+    }
+    return findtrailer_scalar(buf, i, n);
+}
+
+
+__attribute__((target("avx2")))
+static int32_t findtrailer_avx2(const uint8_t *buf, int32_t n)
+{
+    const __m256i c0 = _mm256_set1_epi8((char)sotpet_magic_enc[0]),
+                  c1 = _mm256_set1_epi8((char)sotpet_magic_enc[MAGICSIZE-1]),
+                  c2 = _mm256_set1_epi8((char)sotpet_magic2_enc[0]);
+    uint32_t bits;
+    int32_t i;
+
+    for(i=0; i+32<=n; i+=32)
+    {
+        bits = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf+i)), c0),
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf+i+MAGICSIZE-1)), c1)),
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf+i+OFFMAGIC2)), c2)));
+        for(; bits; bits&=bits-1)
+            if(trailerat(buf+i+__builtin_ctz(bits)))
+                return i+__builtin_ctz(bits);
+    }
+    return findtrailer_scalar(buf, i, n);
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static int32_t findtrailer_avx512(const uint8_t *buf, int32_t n)
+{
+    const __m512i c0 = _mm512_set1_epi8((char)sotpet_magic_enc[0]),
+                  c1 = _mm512_set1_epi8((char)sotpet_magic_enc[MAGICSIZE-1]),
+                  c2 = _mm512_set1_epi8((char)sotpet_magic2_enc[0]);
+    uint64_t bits;
+    int32_t i;
+
+    for(i=0; i+64<=n; i+=64)
+    {
+        bits = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(buf+i)), c0)
+             & _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(buf+i+MAGICSIZE-1)), c1)
+             & _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(buf+i+OFFMAGIC2)), c2);
+        for(; bits; bits&=bits-1)
+            if(trailerat(buf+i+__builtin_ctzll(bits)))
+                return i+__builtin_ctzll(bits);
+    }
+    return findtrailer_scalar(buf, i, n);
+}
+
+#endif
+
+
+int32_t sotpet_findtrailer(const uint8_t *buf, int32_t len)
+{
+    int32_t n = len-ENCRYPTED_TRAILERSIZE+1;     /* offsets a whole trailer fits behind */
+
+    if(n<=0)
+        return -1;
+#if SCAN_VARIANTS
+    switch(cpu_isa)
+    {
+        case ISA_AVX512: return findtrailer_avx512(buf, n);
+        case ISA_AVX2:   return findtrailer_avx2(buf, n);
+        case ISA_SSE4:   return findtrailer_sse4(buf, n);
+    }
+#endif
+    return findtrailer_scalar(buf, 0, n);
+}
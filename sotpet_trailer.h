@@ -10,11 +10,19 @@ extern const uint8_t sotpet_magic2_enc[];
 #define MAGICSIZE2 4
 #define HASHSIZE WHIRLPOOL_DIGESTBYTES
 #define OURVERSION 1
+#define TREEVERSION 2           /* hash is the root over one Whirlpool per sector */
+#define CRCVERSION 3            /* hash is a CRC32C over the plaintext, no more than accidents are found */
+
+/* SORBET_INTEGRITY, which hash goes into the trailer; 0 means decide from the trailer */
+#define INTEGRITY_FLAT  1       /* one Whirlpool over the whole plaintext, OURVERSION */
+#define INTEGRITY_TREE  2       /* TREEVERSION, the leaves are hashed by the workers */
+#define INTEGRITY_CRC   4       /* CRCVERSION, where FLAT would hash */
 
 
 #define OFFMAGIC2 (MAGICSIZE+4)
 
 #define PLAINTEXT_TRAILERSIZE (4+MAGICSIZE+MAGICSIZE2)
+#define CIPHERDIGESTSIZE HASHSIZE   /* Whirlpool over the ciphertext in front of the plaintext trailer, if its trailersize counts it */
 #define ENCRYPTED_TRAILERSIZE (12+HASHSIZE+4+MAGICSIZE+MAGICSIZE2)
 
 
@@ -45,7 +53,21 @@ struct trailerset
     struct plaintext_trailer pln;
     struct encrypted_trailer enc;
     uint8_t                  hash[HASHSIZE];
+    uint8_t                  cthash[CIPHERDIGESTSIZE];   /* -c: the ciphertext digest from the file */
+    uint8_t                  ctdigest[CIPHERDIGESTSIZE]; /* -c: and what the ciphertext came to */
   };
 
 
 #define TRAILERPADDING sizeof(struct encrypted_trailer)
+
+
+void sotpet_leafhash(const uint8_t *data, uint32_t len, uint8_t *digest);
+int  sotpet_integrity_mode(const char *name);
+int  sotpet_version_integrity(int version);
+uint16_t sotpet_integrity_version(int integrity);
+
+uint32_t sotpet_crc32c(uint32_t crc, const uint8_t *data, size_t len);
+void sotpet_crcdigest(uint32_t crc, uint8_t *digest);
+
+/* offset of the first complete encrypted trailer in buf, -1 if there is none */
+int32_t sotpet_findtrailer(const uint8_t *buf, int32_t len);
@@ -0,0 +1,104 @@
+/* camellia_bench.c - cycles per byte of the Camellia-256 backends (kjw)
+ *
+ * see do_camellia_bench.sh, counts TSC ticks, best of several runs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "camellia.h"
+#include "cpudispatch.h"
+
+
+#define BUFBYTES (64*1024)
+#define ROUNDS 32
+#define TRIES 9
+
+
+typedef void (*benchfun)(const KeyTableType *k, const unsigned char *in, unsigned char *out, unsigned blocks);
+
+
+static void table_single(const KeyTableType *k, const unsigned char *in, unsigned char *out, unsigned blocks)
+{
+    for(; blocks>0; blocks--, in+=CAMELLIA_BLOCK_SIZE, out+=CAMELLIA_BLOCK_SIZE)
+        Camellia_EncryptBlock(256, in, k, out);
+}
+
+static void aesni_x16(const KeyTableType *k, const unsigned char *in, unsigned char *out, unsigned blocks)
+{
+    for(; blocks>=16; blocks-=16, in+=16*CAMELLIA_BLOCK_SIZE, out+=16*CAMELLIA_BLOCK_SIZE)
+        camellia_256_x16_aesni(k, in, out, 0);
+}
+
+static void avx2_x32(const KeyTableType *k, const unsigned char *in, unsigned char *out, unsigned blocks)
+{
+    for(; blocks>=32; blocks-=32, in+=32*CAMELLIA_BLOCK_SIZE, out+=32*CAMELLIA_BLOCK_SIZE)
+        camellia_256_x32_avx2(k, in, out, 0);
+}
+
+static void gfni_x64(const KeyTableType *k, const unsigned char *in, unsigned char *out, unsigned blocks)
+{
+    for(; blocks>=64; blocks-=64, in+=64*CAMELLIA_BLOCK_SIZE, out+=64*CAMELLIA_BLOCK_SIZE)
+        camellia_256_x64_gfni(k, in, out, 0);
+}
+
+static void blocks_auto(const KeyTableType *k, const unsigned char *in, unsigned char *out, unsigned blocks)
+{
+    Camellia_EncryptBlocks(256, in, k, out, blocks);
+}
+
+
+static void bench(const char *name, benchfun f, const KeyTableType *k, const unsigned char *in, unsigned char *out)
+{
+    uint64_t t, best = UINT64_MAX;
+    int i, r;
+
+    for(i=0; i<TRIES; i++)
+    {
+        t = __rdtsc();
+        for(r=0; r<ROUNDS; r++)
+            f(k, in, out, BUFBYTES/CAMELLIA_BLOCK_SIZE);
+        t = __rdtsc() - t;
+        if(t<best)
+            best = t;
+    }
+    printf("%-14s %6.2f cycles/byte\n", name, (double)best/((double)BUFBYTES*ROUNDS));
+}
+
+
+int main(void)
+{
+    KeyTableType k[CAMELLIA_TABLE_WORD_LEN];
+    unsigned char raw[32];
+    unsigned char *in, *out;
+    int i;
+
+    in = (unsigned char *)malloc(BUFBYTES);
+    out = (unsigned char *)malloc(BUFBYTES);
+    if(!in || !out)
+        return 1;
+    for(i=0; i<32; i++)
+        raw[i] = rand();
+    for(i=0; i<BUFBYTES; i++)
+        in[i] = rand();
+    Camellia_Ekeygen(256, raw, k);
+
+    cpu_dispatch_init(getenv("SORBET_ISA"));
+    printf("ISA=%s\n", cpu_dispatch_desc());
+
+    bench("table", table_single, k, in, out);
+    if(cpu_isa>=ISA_SSE4 && cpu_has_aes)
+        bench("aesni x16", aesni_x16, k, in, out);
+    if(cpu_isa>=ISA_AVX2 && cpu_has_aes)
+        bench("avx2 x32", avx2_x32, k, in, out);
+    if(cpu_isa>=ISA_AVX512 && cpu_has_gfni)
+        bench("gfni x64", gfni_x64, k, in, out);
+    bench("auto", blocks_auto, k, in, out);
+
+    free(in);
+    free(out);
+    return 0;
+}
@@ -10,3 +10,5 @@ time gpg -c --cipher-algo=camellia256 --compression-algo=Uncompressed \
   --passphrase="xxx" --batch testfile
 time ccrypt -e -b -K "xxx" testfile
 time ../../sorbet -e do_bench.sh testfile.cpt testfile.xxx
+rm -f testfile.xxx
+time env SORBET_INTEGRITY=crc32c ../../sorbet -e do_bench.sh testfile.cpt testfile.xxx
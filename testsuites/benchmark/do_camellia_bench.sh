@@ -0,0 +1,17 @@
+#! /bin/sh
+
+# cycles per byte of the table driven Camellia against the vector kernels,
+# SORBET_ISA limits them like it does for sorbet
+
+set -x
+
+C=../../camellia-BSD
+CXXFLAGS="-O2 -march=x86-64 -I$C -I../../compat -DSOTPET_DISPATCH=1"
+
+rm -f camellia_bench *.o
+g++ $CXXFLAGS -msse4.1 -msse4.2 -maes -c -o camellia_aesni.o $C/camellia_aesni.c || exit 1
+g++ $CXXFLAGS -mavx2 -maes -DCAMELLIA_X32 -c -o camellia_avx2.o $C/camellia_aesni.c || exit 1
+g++ $CXXFLAGS -mavx512f -mavx512bw -mgfni -c -o camellia_gfni.o $C/camellia_gfni.c || exit 1
+g++ $CXXFLAGS -o camellia_bench camellia_bench.c $C/camellia.c ../../compat/cpudispatch.c *.o || exit 1
+./camellia_bench
+rm -f camellia_bench *.o
@@ -0,0 +1,20 @@
+#! /bin/sh
+
+# startup latency: many small files, one process each, as a backup script
+# would run it.  SORBET_CPUS is left to the caller, it's about what that
+# many workers cost when there's next to nothing to do.
+
+N=${N:-200}
+
+rm -f smallfile*
+dd if=/dev/urandom bs=1 count=2048 of=smallfile 2>/dev/null
+: >smallfile.0
+
+for f in smallfile.0 smallfile
+do
+    echo "$N x $f, encrypt then decrypt"
+    time sh -c "i=0; while [ \$i -lt $N ]; do ../../sorbet -e do_startup_bench.sh <$f >$f.cpt 2>/dev/null; i=\$((i+1)); done"
+    time sh -c "i=0; while [ \$i -lt $N ]; do ../../sorbet -d do_startup_bench.sh <$f.cpt >$f.out 2>/dev/null; i=\$((i+1)); done"
+    cmp $f $f.out
+done
+rm -f smallfile*
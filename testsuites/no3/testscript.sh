@@ -0,0 +1,44 @@
+#! /bin/sh
+
+# -r, re-encryption with a new password in one pass
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+PWFILE2="pwfile_2.txt"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+./sorbet -e $PWFILE $INFILE tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -r $PWFILE $PWFILE2 tmp_1_$$ tmp_2_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -d $PWFILE2 tmp_2_$$ tmp_3_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_3_$$
+echo is: $? should be: 0
+./sorbet -d $PWFILE tmp_2_$$ tmp_4_$$ 2>/dev/null
+echo is: $? should be: 2
+
+# the old password has to be right
+./sorbet -r $PWFILE $PWFILE2 tmp_2_$$ tmp_5_$$ 2>/dev/null
+echo is: $? should be: 2
+
+# and back, through pipes this time: the padding comes along, so it is
+# the very same ciphertext again
+cat tmp_2_$$ | ./sorbet -r $PWFILE2 $PWFILE >tmp_6_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp tmp_1_$$ tmp_6_$$
+echo is: $? should be: 0
+./sorbet -d $PWFILE <tmp_6_$$ >tmp_7_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_7_$$
+echo is: $? should be: 0
+
+# the trailer is checked on the way
+cp tmp_2_$$ tmp_8_$$
+printf 'XXXXXXXXXXXXXXXX' | dd of=tmp_8_$$ bs=1 seek=5000 conv=notrunc 2>/dev/null
+./sorbet -r $PWFILE2 $PWFILE tmp_8_$$ tmp_9_$$ 2>/dev/null
+echo is: $? should be: 1
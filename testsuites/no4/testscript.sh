@@ -0,0 +1,33 @@
+#! /bin/sh
+
+# -v, decrypts and checks the trailer, writes nothing
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+PWFILE2="pwfile_2.txt"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+./sorbet -e $PWFILE $INFILE tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -v $PWFILE tmp_1_$$ >tmp_2_$$ 2>/dev/null
+echo is: $? should be: 0
+test -s tmp_2_$$
+echo is: $? should be: 1
+cat tmp_1_$$ | ./sorbet -v $PWFILE 2>/dev/null
+echo is: $? should be: 0
+./sorbet -v $PWFILE2 tmp_1_$$ 2>/dev/null
+echo is: $? should be: 2
+
+cp tmp_1_$$ tmp_3_$$
+printf 'XXXXXXXXXXXXXXXX' | dd of=tmp_3_$$ bs=1 seek=5000 conv=notrunc 2>/dev/null
+./sorbet -v $PWFILE tmp_3_$$ 2>/dev/null
+echo is: $? should be: 1
+
+# -b needs no outfile
+printf 'tmp_1_%s\ntmp_3_%s\n' $$ $$ >tmp_l_$$
+./sorbet -v $PWFILE -b tmp_l_$$ 2>/dev/null
+echo is: $? should be: 1
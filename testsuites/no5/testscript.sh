@@ -0,0 +1,44 @@
+#! /bin/sh
+
+# -c, the ciphertext digest, checked without the password
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+PWFILE2="pwfile_2.txt"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+SORBET_CIPHERDIGEST=1 ./sorbet -e $PWFILE $INFILE tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -c tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -c <tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -d $PWFILE tmp_1_$$ tmp_2_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_2_$$
+echo is: $? should be: 0
+
+# without one there is nothing to check
+./sorbet -e $PWFILE $INFILE tmp_3_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -c tmp_3_$$ 2>/dev/null
+echo is: $? should be: 2
+
+cp tmp_1_$$ tmp_4_$$
+printf 'XXXXXXXXXXXXXXXX' | dd of=tmp_4_$$ bs=1 seek=5000 conv=notrunc 2>/dev/null
+./sorbet -c tmp_4_$$ 2>/dev/null
+echo is: $? should be: 1
+
+# a new password means new ciphertext, the digest has to follow
+./sorbet -r $PWFILE $PWFILE2 tmp_1_$$ tmp_5_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -c tmp_5_$$ 2>/dev/null
+echo is: $? should be: 0
+cat tmp_5_$$ | ./sorbet -r $PWFILE2 $PWFILE >tmp_6_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -c tmp_6_$$ 2>/dev/null
+echo is: $? should be: 0
@@ -0,0 +1,51 @@
+#! /bin/sh
+
+# SORBET_INTEGRITY=crc32c, against accidents only; -d takes the kind of
+# trailer from the file, whatever SORBET_INTEGRITY says then
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+PWFILE2="pwfile_2.txt"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+SORBET_INTEGRITY=crc32c ./sorbet -e $PWFILE $INFILE tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -d $PWFILE tmp_1_$$ tmp_2_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_2_$$
+echo is: $? should be: 0
+cat tmp_1_$$ | ./sorbet -d $PWFILE >tmp_3_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_3_$$
+echo is: $? should be: 0
+./sorbet -d $PWFILE2 tmp_1_$$ tmp_4_$$ 2>/dev/null
+echo is: $? should be: 2
+
+cp tmp_1_$$ tmp_5_$$
+printf 'XXXXXXXXXXXXXXXX' | dd of=tmp_5_$$ bs=1 seek=5000 conv=notrunc 2>/dev/null
+./sorbet -d $PWFILE tmp_5_$$ tmp_6_$$ 2>/dev/null
+echo is: $? should be: 1
+cat tmp_5_$$ | ./sorbet -d $PWFILE >tmp_7_$$ 2>/dev/null
+echo is: $? should be: 1
+
+# one SORBET_INTEGRITY for both ways, or another one for -d
+./sorbet -e $PWFILE $INFILE tmp_8_$$ 2>/dev/null
+echo is: $? should be: 0
+SORBET_INTEGRITY=crc32c ./sorbet -d $PWFILE tmp_8_$$ tmp_9_$$ 2>/dev/null
+echo is: $? should be: 0
+cat tmp_8_$$ | SORBET_INTEGRITY=crc32c ./sorbet -d $PWFILE >tmp_10_$$ 2>/dev/null
+echo is: $? should be: 0
+SORBET_INTEGRITY=crc32c ./sorbet -d $PWFILE tmp_1_$$ tmp_11_$$ 2>/dev/null
+echo is: $? should be: 0
+SORBET_INTEGRITY=tree ./sorbet -d $PWFILE <tmp_1_$$ >tmp_12_$$ 2>/dev/null
+echo is: $? should be: 0
+SORBET_INTEGRITY=whirlpool ./sorbet -v $PWFILE tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+SORBET_INTEGRITY=tree ./sorbet -r $PWFILE $PWFILE2 tmp_1_$$ tmp_13_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_12_$$
+echo is: $? should be: 0
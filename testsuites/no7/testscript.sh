@@ -0,0 +1,42 @@
+#! /bin/sh
+
+# -b, a list of files through one context; every file gets a status line,
+# the highest status comes back
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+PWFILE2="pwfile_2.txt"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+head -c 1000 $INFILE >tmp_in1_$$
+head -c 100000 $INFILE >tmp_in2_$$
+cp $INFILE tmp_in3_$$
+for i in 1 2 3
+do
+  printf 'tmp_in%s_%s\ttmp_e%s_%s\n' $i $$ $i $$ >>tmp_l1_$$
+  printf 'tmp_e%s_%s\ttmp_d%s_%s\n' $i $$ $i $$ >>tmp_l2_$$
+done
+
+./sorbet -e $PWFILE -b tmp_l1_$$ 2>/dev/null
+echo is: $? should be: 0
+./sorbet -d $PWFILE -b - <tmp_l2_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp tmp_in1_$$ tmp_d1_$$ && cmp tmp_in2_$$ tmp_d2_$$ && cmp tmp_in3_$$ tmp_d3_$$
+echo is: $? should be: 0
+
+# a file each batch would give 2 and 1 for on its own
+rm -f tmp_d*
+./sorbet -d $PWFILE2 -b tmp_l2_$$ 2>/dev/null
+echo is: $? should be: 2
+rm -f tmp_d*
+printf 'XXXXXXXXXXXXXXXX' | dd of=tmp_e2_$$ bs=1 seek=5000 conv=notrunc 2>/dev/null
+./sorbet -d $PWFILE -b tmp_l2_$$ >tmp_st_$$ 2>/dev/null
+echo is: $? should be: 1
+grep -c '^0	' tmp_st_$$
+echo is: $? should be: 0
+cmp tmp_in3_$$ tmp_d3_$$
+echo is: $? should be: 0
@@ -0,0 +1,56 @@
+#! /bin/sh
+
+# -d --offset --length, a window of the plaintext; the trailer can't be
+# checked that way, so it is always 3 and the bytes tell
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+PWFILE2="pwfile_2.txt"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+./sorbet -e $PWFILE $INFILE tmp_1_$$ 2>/dev/null
+echo is: $? should be: 0
+
+./sorbet -d --offset 1000 --length 5000 $PWFILE tmp_1_$$ tmp_2_$$ 2>/dev/null
+echo is: $? should be: 3
+dd if=$INFILE bs=1000 skip=1 count=5 2>/dev/null | cmp - tmp_2_$$
+echo is: $? should be: 0
+./sorbet -d $PWFILE --offset 0 --length 1 <tmp_1_$$ >tmp_3_$$ 2>/dev/null
+echo is: $? should be: 3
+head -c 1 $INFILE | cmp - tmp_3_$$
+echo is: $? should be: 0
+
+# to the end of the plaintext, and past it
+./sorbet -d --offset 1000 $PWFILE tmp_1_$$ tmp_4_$$ 2>/dev/null
+echo is: $? should be: 3
+tail -c +1001 $INFILE | cmp - tmp_4_$$
+echo is: $? should be: 0
+./sorbet -d --offset 1000000000000 --length 10 $PWFILE tmp_1_$$ tmp_5_$$ 2>/dev/null
+echo is: $? should be: 3
+test -s tmp_5_$$
+echo is: $? should be: 1
+
+# a changed sector only spoils itself and the next one
+cp tmp_1_$$ tmp_6_$$
+printf 'XXXXXXXXXXXXXXXX' | dd of=tmp_6_$$ bs=1 seek=5000 conv=notrunc 2>/dev/null
+./sorbet -d --offset 4096 --length 2048 $PWFILE tmp_6_$$ tmp_7_$$ 2>/dev/null
+echo is: $? should be: 3
+dd if=$INFILE bs=1024 skip=4 count=2 2>/dev/null | cmp -s - tmp_7_$$
+echo is: $? should be: 1
+./sorbet -d --offset 8192 --length 2048 $PWFILE tmp_6_$$ tmp_8_$$ 2>/dev/null
+echo is: $? should be: 3
+dd if=$INFILE bs=1024 skip=8 count=2 2>/dev/null | cmp - tmp_8_$$
+echo is: $? should be: 0
+
+# not from a pipe
+cat tmp_1_$$ | ./sorbet -d --offset 1000 --length 5000 $PWFILE >tmp_9_$$ 2>/dev/null
+echo is: $? should be: 5
+
+# a regular file, but the ciphertext doesn't start where it stands
+(dd bs=1 count=1 of=/dev/null 2>/dev/null; ./sorbet -d --offset 0 --length 10 $PWFILE 2>tmp_10_$$ >/dev/null) <tmp_1_$$
+grep -q 'start at the beginning' tmp_10_$$
+echo is: $? should be: 0
@@ -0,0 +1,33 @@
+#! /bin/sh
+
+# encrypting into a pipe: a reader that splices it on, like pv, must get
+# the ciphertext as it was; SORBET_VMSPLICE=1 for a reader that copies
+
+INFILE=testfile
+PWFILE="pwfile.txt"
+SPLICE="import os
+while os.splice(0, 1, 1<<20): pass"
+# V=valgrind
+
+set -x
+
+rm -fv tmp_*
+
+cat $INFILE | ./sorbet -e $PWFILE 2>/dev/null | python3 -c "$SPLICE" | (sleep 1; cat) >tmp_1_$$
+./sorbet -d $PWFILE tmp_1_$$ tmp_2_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_2_$$
+echo is: $? should be: 0
+
+cat $INFILE | SORBET_VMSPLICE=1 ./sorbet -e $PWFILE 2>/dev/null | cat >tmp_3_$$
+./sorbet -d $PWFILE tmp_3_$$ tmp_4_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_4_$$
+echo is: $? should be: 0
+
+# a slow reader, the slots have to wait until the pipe is drained
+cat $INFILE | SORBET_VMSPLICE=1 SORBET_NUMBLOCKS=2 ./sorbet -e $PWFILE 2>/dev/null | dd bs=100 2>/dev/null >tmp_5_$$
+./sorbet -d $PWFILE tmp_5_$$ tmp_6_$$ 2>/dev/null
+echo is: $? should be: 0
+cmp $INFILE tmp_6_$$
+echo is: $? should be: 0
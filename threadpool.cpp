@@ -0,0 +1,194 @@
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include "threadpool.hpp"
+
+
+/*
+class PoolGroup
+    {
+        protected:
+
+            pthread_mutex_t     mtx;
+            pthread_cond_t      cv;
+            int32_t             pending;
+*/
+
+                PoolGroup::PoolGroup()
+{
+    pthread_mutex_init(&this->mtx, NULL);
+    pthread_cond_init(&this->cv, NULL);
+    this->pending = 0;
+}
+
+
+                PoolGroup::~PoolGroup()
+{
+    pthread_cond_destroy(&this->cv);
+    pthread_mutex_destroy(&this->mtx);
+}
+
+
+void            PoolGroup::add(int32_t n /* =1 */)
+{
+    pthread_mutex_lock(&this->mtx);
+    this->pending += n;
+    pthread_mutex_unlock(&this->mtx);
+}
+
+
+void            PoolGroup::done()
+{
+    pthread_mutex_lock(&this->mtx);
+    if(--this->pending<=0)
+        pthread_cond_broadcast(&this->cv);
+    pthread_mutex_unlock(&this->mtx);
+}
+
+
+void            PoolGroup::wait()
+{
+    pthread_mutex_lock(&this->mtx);
+    while(this->pending>0)
+        pthread_cond_wait(&this->cv, &this->mtx);
+    pthread_mutex_unlock(&this->mtx);
+}
+
+
+/*
+class ThreadPool
+    {
+        protected:
+
+            pthread_t          *threads;
+            uint16_t            nthreads,
+                                maxthreads,
+                                idle;
+            pthread_mutex_t     mtx;
+            pthread_cond_t      cv;
+            std::deque<PoolJob> queue;
+            bool                quit;
+*/
+
+/*
+ * No worker is started here, submit() starts one whenever the queued jobs
+ * outnumber the idle ones, up to nthreads.  A small file is done with one
+ * thread, a big one has them all after the first batch.  Once started, a
+ * worker lives as long as the pool, so pthread_create() is paid only once.
+ */
+
+                ThreadPool::ThreadPool(uint16_t nthreads)
+{
+    if(nthreads<1)
+        nthreads = 1;
+    pthread_mutex_init(&this->mtx, NULL);
+    pthread_cond_init(&this->cv, NULL);
+    this->quit = false;
+    this->nthreads = 0;
+    this->maxthreads = nthreads;
+    this->idle = 0;
+    this->threads = new pthread_t[nthreads];
+}
+
+
+                ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&this->mtx);
+    this->quit = true;
+    pthread_cond_broadcast(&this->cv);
+    pthread_mutex_unlock(&this->mtx);
+
+    for(uint16_t i=0; i<this->nthreads; i++)
+        pthread_join(this->threads[i], NULL);
+
+    delete[] this->threads;
+    pthread_cond_destroy(&this->cv);
+    pthread_mutex_destroy(&this->mtx);
+}
+
+
+/* one more worker, with mtx held; it counts as idle until it takes a job */
+
+bool            ThreadPool::spawn()
+{
+    int r;
+
+    r = pthread_create(&this->threads[this->nthreads], NULL, ThreadPool::worker, (void *)this);
+    if(r)
+    {
+        errno = r;
+        perror("pthread_create");
+        return false;
+    }
+    this->nthreads++;
+    this->idle++;
+    return true;
+}
+
+
+void           *ThreadPool::worker(void *data)
+{
+    ThreadPool *pool = (ThreadPool *)data;
+    PoolJob job;
+
+    pthread_mutex_lock(&pool->mtx);
+    for(;;)
+    {
+        while(pool->queue.empty() && !pool->quit)
+            pthread_cond_wait(&pool->cv, &pool->mtx);
+        if(pool->queue.empty())
+            /* quit, but only after the queue has been drained */
+            break;
+        job = pool->queue.front();
+        pool->queue.pop_front();
+        pool->idle--;
+        pthread_mutex_unlock(&pool->mtx);
+
+        job.fn(job.data);
+        if(job.group)
+            job.group->done();
+
+        pthread_mutex_lock(&pool->mtx);
+        pool->idle++;
+    }
+    pthread_mutex_unlock(&pool->mtx);
+    return NULL;
+}
+
+
+void            ThreadPool::submit(PoolJobFn fn, void *data, PoolGroup *group)
+{
+    PoolJob job;
+
+    job.fn = fn;
+    job.data = data;
+    job.group = group;
+    if(group)
+        group->add();
+
+    pthread_mutex_lock(&this->mtx);
+    if(this->queue.size()>=this->idle && this->nthreads<this->maxthreads)
+        this->spawn();
+    if(!this->nthreads)
+    {
+        /* not a single thread to be had, the caller does it */
+        pthread_mutex_unlock(&this->mtx);
+        fn(data);
+        if(group)
+            group->done();
+        return;
+    }
+    this->queue.push_back(job);
+    pthread_cond_signal(&this->cv);
+    pthread_mutex_unlock(&this->mtx);
+}
+
+
+uint16_t        ThreadPool::getsize()
+{
+    return this->maxthreads;
+}
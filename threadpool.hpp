@@ -0,0 +1,64 @@
+/* SOTPET - Simple One-Trick Pony Encryption Tool */
+
+#include <pthread.h>
+#include <deque>
+
+
+typedef void *(*PoolJobFn)(void *data);
+
+
+/* counts the jobs of one submitter, so several submitters can share a pool */
+
+class PoolGroup
+    {
+        protected:
+
+            pthread_mutex_t     mtx;
+            pthread_cond_t      cv;
+            int32_t             pending;
+
+        public:
+
+            PoolGroup();
+            ~PoolGroup();
+
+            void            add(int32_t n=1);
+            void            done();
+            void            wait();
+    };
+
+
+class PoolJob
+    {
+        public:
+
+            PoolJobFn           fn;
+            void               *data;
+            PoolGroup          *group;
+    };
+
+
+class ThreadPool
+    {
+        protected:
+
+            pthread_t          *threads;
+            uint16_t            nthreads,
+                                maxthreads,
+                                idle;
+            pthread_mutex_t     mtx;
+            pthread_cond_t      cv;
+            std::deque<PoolJob> queue;
+            bool                quit;
+
+            static void        *worker(void *data);
+            bool                spawn();
+
+        public:
+
+            ThreadPool(uint16_t nthreads);
+            ~ThreadPool();
+
+            void            submit(PoolJobFn fn, void *data, PoolGroup *group);
+            uint16_t        getsize();
+    };
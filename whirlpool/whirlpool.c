@@ -1241,16 +1241,43 @@ static const uint64_t rc[R + 1] = {
 
 
 /**
- * The core Whirlpool transform.
+ * Big-endian 64-bit load (kjw).
  */
-static void whirlpool_processbuffer(struct whirlpool *wp)
+static inline uint64_t whirlpool_load64(const uint8_t *p)
+{
+#if defined(BYTEORDER) && BYTEORDER=='L' && defined(__GNUC__)
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+#elif defined(BYTEORDER) && BYTEORDER=='B'
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+#else
+    return
+            (((uint64_t)p[0]        ) << 56) ^
+            (((uint64_t)p[1] & 0xffL) << 48) ^
+            (((uint64_t)p[2] & 0xffL) << 40) ^
+            (((uint64_t)p[3] & 0xffL) << 32) ^
+            (((uint64_t)p[4] & 0xffL) << 24) ^
+            (((uint64_t)p[5] & 0xffL) << 16) ^
+            (((uint64_t)p[6] & 0xffL) <<  8) ^
+            (((uint64_t)p[7] & 0xffL)      );
+#endif
+}
+
+/**
+ * The core Whirlpool transform, on wp->buffer or straight on the caller's data.
+ */
+static void whirlpool_compress(struct whirlpool *wp, const uint8_t *buffer)
 {
     int i, r;
     uint64_t K[8];        /* the round key */
     uint64_t block[8];    /* mu(buffer) */
     uint64_t state[8];    /* the cipher state */
     uint64_t L[8];
-    uint8_t *buffer = wp->buffer;
 
 #ifdef TRACE_INTERMEDIATE_VALUES
     printf("The 8x8 matrix Z' derived from the data-string is as follows.\n");
@@ -1270,15 +1297,7 @@ static void whirlpool_processbuffer(struct whirlpool *wp)
      * map the buffer to a block:
      */
     for (i = 0; i < 8; i++, buffer += 8) {
-        block[i] =
-                (((uint64_t)buffer[0]        ) << 56) ^
-                (((uint64_t)buffer[1] & 0xffL) << 48) ^
-                (((uint64_t)buffer[2] & 0xffL) << 40) ^
-                (((uint64_t)buffer[3] & 0xffL) << 32) ^
-                (((uint64_t)buffer[4] & 0xffL) << 24) ^
-                (((uint64_t)buffer[5] & 0xffL) << 16) ^
-                (((uint64_t)buffer[6] & 0xffL) <<  8) ^
-                (((uint64_t)buffer[7] & 0xffL)      );
+        block[i] = whirlpool_load64(buffer);
     }
     assert(wp->bufferBits>=0);
 
@@ -1568,6 +1587,11 @@ static void whirlpool_processbuffer(struct whirlpool *wp)
 #endif /* ?TRACE_INTERMEDIATE_VALUES */
 }
 
+static void whirlpool_processbuffer(struct whirlpool *wp)
+{
+    whirlpool_compress(wp, wp->buffer);
+}
+
 /**
  * Initialize the hashing state.
  */
@@ -1602,6 +1626,22 @@ void whirlpool_init(struct whirlpool *wp)
 #endif /* ?TRACE_INTERMEDIATE_VALUES */
 }
 
+/**
+ * Adds to the 256-bit length counter.
+ */
+static void whirlpool_tally(struct whirlpool *wp, uint64_t value)
+{
+    int i;
+    uint32_t carry;
+
+    for (i = 31, carry = 0; i >= 0 && (carry != 0 || value != LL(0)); i--) {
+        carry += wp->bitLength[i] + ((uint32_t)value & 0xff);
+        wp->bitLength[i] = (uint8_t)carry;
+        carry >>= 8;
+        value >>= 8;
+    }
+}
+
 /**
  * Delivers input data to the hashing algorithm.
  *
@@ -1627,20 +1667,12 @@ void whirlpool_add(struct whirlpool *wp, const uint8_t * const source, unsigned
     int sourcePos    = 0; /* index of leftmost source uint8_t containing data (1 to 8 bits). */
     int sourceGap    = (8 - ((unsigned)sourceBits & 7)) & 7; /* space on source[sourcePos]. */
     int bufferRem    = wp->bufferBits & 7; /* occupied bits on buffer[bufferPos]. */
-    int i;
-    uint32_t b, carry;
+    uint32_t b;
 
     /*
      * tally the length of the added data:
      */
-    uint64_t value = sourceBits;
-
-    for (i = 31, carry = 0; i >= 0 && (carry != 0 || value != LL(0)); i--) {
-        carry += wp->bitLength[i] + ((uint32_t)value & 0xff);
-        wp->bitLength[i] = (uint8_t)carry;
-        carry >>= 8;
-        value >>= 8;
-    }
+    whirlpool_tally(wp, sourceBits);
 
     /*
      * process data in chunks of 8 bits (a more efficient approach would be to take whole-word chunks):
@@ -1740,6 +1772,63 @@ void whirlpool_add(struct whirlpool *wp, const uint8_t * const source, unsigned
     }
 }
 
+/**
+ * Delivers byte-aligned input data to the hashing algorithm (kjw).
+ *
+ * @param    source        plaintext data to hash.
+ * @param    sourceBytes   how many bytes of plaintext to process.
+ *
+ * Same result as whirlpool_add(wp, source, sourceBytes*8), but whole blocks
+ * are compressed straight from source.  Falls back to whirlpool_add() when
+ * an earlier call left a partial byte on the buffer.
+ */
+void whirlpool_add_bytes(struct whirlpool *wp, const uint8_t *source, size_t sourceBytes)
+{
+    size_t n;
+
+    if (wp->bufferBits & 7)
+    {
+        whirlpool_add(wp, source, sourceBytes*8);
+        return;
+    }
+    whirlpool_tally(wp, (uint64_t)sourceBytes*8);
+
+    /*
+     * top up what is left on the buffer:
+     */
+    if (wp->bufferPos > 0)
+    {
+        n = WHIRLPOOL_WBLOCKBYTES - wp->bufferPos;
+        if (n > sourceBytes)
+            n = sourceBytes;
+        memcpy(&wp->buffer[wp->bufferPos], source, n);
+        wp->bufferPos += n;
+        source += n;
+        sourceBytes -= n;
+        if (wp->bufferPos == WHIRLPOOL_WBLOCKBYTES)
+        {
+            whirlpool_processbuffer(wp);
+            wp->bufferPos = 0;
+        }
+    }
+    /*
+     * whole blocks need no copy:
+     */
+    for (; sourceBytes >= WHIRLPOOL_WBLOCKBYTES; sourceBytes -= WHIRLPOOL_WBLOCKBYTES, source += WHIRLPOOL_WBLOCKBYTES)
+    {
+        whirlpool_compress(wp, source);
+    }
+    if (sourceBytes > 0)
+    {
+        memcpy(&wp->buffer[wp->bufferPos], source, sourceBytes);
+        wp->bufferPos += sourceBytes;
+    }
+    wp->bufferBits = 8*wp->bufferPos;
+    /* whirlpool_add() and whirlpool_finalize() OR into buffer[bufferPos] */
+    if (wp->bufferPos < WHIRLPOOL_WBLOCKBYTES)
+        wp->buffer[wp->bufferPos] = 0;
+}
+
 /**
  * Get the hash value from the hashing state.
  *
@@ -28,5 +28,6 @@ struct whirlpool
 /* void whirlpool_processbuffer(struct whirlpool *wp); */
 void whirlpool_init(struct whirlpool *wp);
 void whirlpool_add(struct whirlpool *wp, const uint8_t * const source, unsigned long sourceBits);
+void whirlpool_add_bytes(struct whirlpool *wp, const uint8_t *source, size_t sourceBytes);
 void whirlpool_finalize(struct whirlpool *wp, uint8_t * const result);
 const uint8_t *whirlpool_hexhash(struct whirlpool *wp);